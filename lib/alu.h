@@ -46,6 +46,27 @@ public:
             case SLTU: case SLTIU: 
             case BLTU: case BGEU:
                 return unsigned(opd1) < unsigned(opd2)? 1: 0;
+            case MUL:
+                return opd1 * opd2;
+            case MULH:
+                return (long long)(signed(opd1)) * signed(opd2) >> 32;
+            case MULHSU:
+                return (long long)(signed(opd1)) * (unsigned long long)(opd2) >> 32;
+            case MULHU:
+                return (unsigned long long)(opd1) * opd2 >> 32;
+            // division by zero and overflow follow the spec instead of trapping
+            case DIV:
+                if(!opd2) return -1;
+                if(opd1 == 0x80000000u && opd2 == ~0u) return opd1;
+                return signed(opd1) / signed(opd2);
+            case DIVU:
+                return opd2? opd1 / opd2: ~0u;
+            case REM:
+                if(!opd2) return opd1;
+                if(opd1 == 0x80000000u && opd2 == ~0u) return 0;
+                return signed(opd1) % signed(opd2);
+            case REMU:
+                return opd2? opd1 % opd2: opd1;
             default:
                 return -1;
         }
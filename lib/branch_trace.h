@@ -0,0 +1,131 @@
+#ifndef __RISCV_SIMULATOR_BRANCH_TRACE_H__
+#define __RISCV_SIMULATOR_BRANCH_TRACE_H__
+
+#include "utils.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace riscv {
+
+// trace layout: "RVBT" followed by one record per committed conditional branch
+//   varint (gap << 1 | jump)   instructions committed since the previous record, branch included
+//   varint zigzag(pc - last pc)
+//   varint zigzag(target - pc)
+// a zero byte ends the records and is followed by varint of the trailing instruction count
+
+struct Branch_record {
+    addr_t pc, target;
+    bool jump;
+    word gap;
+};
+
+class Branch_trace_writer {
+private:
+    FILE *fp;
+    addr_t last_pc;
+    long long gap;
+    std::vector<byte> buf;
+
+    void put(u_int64_t val) {
+        while(val >= 128) buf.push_back(val & 127 | 128), val >>= 7;
+        buf.push_back(val);
+    }
+    static word zigzag(int delta) {
+        return (word(delta) << 1) ^ word(delta >> 31);
+    }
+    void drain() {
+        if(!buf.empty()) fwrite(buf.data(), 1, buf.size(), fp);
+        buf.clear();
+    }
+
+public:
+    Branch_trace_writer(): fp(nullptr), last_pc(0), gap(0) {}
+    ~Branch_trace_writer() {close(); }
+
+    bool open(const std::string &path) {
+        fp = fopen(path.c_str(), "wb");
+        if(!fp) return 0;
+        fwrite("RVBT", 1, 4, fp);
+        return 1;
+    }
+    bool opened() {return fp != nullptr; }
+
+    // called once per committed instruction
+    void step() {gap++; }
+
+    void record(addr_t pc, addr_t target, bool jump) {
+        put(u_int64_t(gap) << 1 | jump);
+        put(zigzag(int(pc - last_pc)));
+        put(zigzag(int(target - pc)));
+        last_pc = pc, gap = 0;
+        if(buf.size() >= (1 << 16)) drain();
+    }
+
+    void close() {
+        if(!fp) return ;
+        buf.push_back(0), put(gap);
+        drain(), fclose(fp);
+        fp = nullptr;
+    }
+};
+
+class Branch_trace_reader {
+private:
+    std::vector<byte> data;
+    size_t pos;
+    addr_t last_pc;
+    long long tail;
+
+    bool get(u_int64_t &val) {
+        val = 0;
+        for(int sh = 0; pos < data.size(); sh += 7) {
+            byte b = data[pos++];
+            val |= u_int64_t(b & 127) << sh;
+            if(!(b & 128)) return 1;
+        }
+        return 0;
+    }
+    static int unzigzag(u_int64_t val) {
+        return int(word(val) >> 1) ^ -int(val & 1);
+    }
+
+public:
+    Branch_trace_reader(): pos(0), last_pc(0), tail(0) {}
+
+    bool open(const std::string &path) {
+        FILE *fp = fopen(path.c_str(), "rb");
+        if(!fp) return 0;
+        byte chunk[1 << 16];
+        size_t len;
+        while((len = fread(chunk, 1, sizeof(chunk), fp)) > 0) data.insert(data.end(), chunk, chunk + len);
+        fclose(fp);
+        if(data.size() < 4 || std::string(data.begin(), data.begin() + 4) != "RVBT") return 0;
+        pos = 4;
+        return 1;
+    }
+
+    // false once the end marker (or a truncated record) is reached
+    bool next(Branch_record &rec) {
+        u_int64_t head, dpc, dtarget;
+        if(!get(head)) return 0;
+        if(head == 0) {
+            u_int64_t val = 0;
+            if(get(val)) tail = val;
+            return 0;
+        }
+        if(!get(dpc) || !get(dtarget)) return 0;
+        rec.gap = head >> 1, rec.jump = head & 1;
+        rec.pc = last_pc + unzigzag(dpc);
+        rec.target = rec.pc + unzigzag(dtarget);
+        last_pc = rec.pc;
+        return 1;
+    }
+
+    // instructions committed after the last branch, valid once next() returned false
+    long long trailing() {return tail; }
+};
+
+}
+
+#endif
@@ -32,6 +32,11 @@ public:
     void flush() {
         this->nex_stat().flag = 0;
     }
+    // drop the message in flight if `pred` holds for it
+    template <typename F>
+    void cancel_if(F pred) {
+        if(this->nex_stat().flag && pred(this->nex_stat().data)) this->nex_stat().flag = 0;
+    }
     
 };
 
@@ -0,0 +1,256 @@
+#ifndef __RISCV_SIMULATOR_CACHE_H__
+#define __RISCV_SIMULATOR_CACHE_H__
+
+#include "utils.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+
+namespace riscv {
+
+// one level of the memory hierarchy, timing only (data always lives in RAM);
+// an access is identified by a ticket whose completion is polled every cycle
+class Memory_level {
+public:
+    virtual ~Memory_level() {}
+    // start an access, returns -1 when the level cannot accept it this cycle
+    virtual int request(addr_t addr, bool write) = 0;
+    virtual bool ready(int ticket) = 0;
+    // hand the ticket back, work already started (e.g. a line fill) still completes
+    virtual void release(int ticket) = 0;
+    virtual void tick() = 0;
+    virtual void report(std::ostream &os) {}
+};
+
+// ready cycle per ticket, -1 while still unknown
+class Ticket_pool {
+private:
+    std::vector<long long> when;
+    std::vector<int> tag;
+    std::vector<int> avail;
+
+public:
+    int allocate(long long ready, int owner = -1) {
+        int id;
+        if(avail.empty()) id = when.size(), when.push_back(0), tag.push_back(0);
+        else id = avail.back(), avail.pop_back();
+        when[id] = ready, tag[id] = owner;
+        return id;
+    }
+    void free(int id) {
+        tag[id] = -2, avail.push_back(id);
+    }
+    bool done(int id, long long now) {return when[id] >= 0 && when[id] <= now; }
+    void set(int id, long long ready) {when[id] = ready; }
+    // wake up every live ticket owned by `owner`
+    void wake(int owner, long long ready) {
+        for(int i = 0; i < int(tag.size()); ++i) {
+            if(tag[i] == owner) when[i] = ready, tag[i] = -1;
+        }
+    }
+};
+
+class Fixed_memory: public Memory_level {
+private:
+    int latency;
+    long long now;
+    Ticket_pool pool;
+    long long reads, writes;
+
+public:
+    explicit Fixed_memory(int lat): latency(lat), now(0), reads(0), writes(0) {}
+
+    int request(addr_t addr, bool write) override {
+        if(write) writes++; else reads++;
+        return pool.allocate(now + latency);
+    }
+    bool ready(int ticket) override {return pool.done(ticket, now); }
+    void release(int ticket) override {pool.free(ticket); }
+    void tick() override {now++; }
+    void report(std::ostream &os) override {
+        os << "[memory] read " << reads << " write " << writes << '\n';
+    }
+};
+
+struct Cache_config {
+    int size, assoc, line, latency, mshr;
+    std::string policy;     // lru, fifo, random
+
+    Cache_config(int sz = 0, int as = 0, int ln = 64, int lat = 1, int ms = 4):
+        size(sz), assoc(as), line(ln), latency(lat), mshr(ms), policy("lru") {}
+
+    // parse "key=val,..." with keys size, assoc, line, latency, mshr, policy
+    static bool parse(const std::string &spec, Cache_config &cfg) {
+        std::stringstream ss(spec);
+        std::string item;
+        while(std::getline(ss, item, ',')) {
+            auto eq = item.find('=');
+            if(eq == std::string::npos) return 0;
+            auto key = item.substr(0, eq), val = item.substr(eq + 1);
+            if(key == "policy") {
+                if(val != "lru" && val != "fifo" && val != "random") return 0;
+                cfg.policy = val; continue;
+            }
+            char *end;
+            long num = std::strtol(val.c_str(), &end, 10);
+            if(*end == 'K' || *end == 'k') num <<= 10, end++;
+            else if(*end == 'M' || *end == 'm') num <<= 20, end++;
+            if(*end || num <= 0) return 0;
+            if(key == "size") cfg.size = num;
+            else if(key == "assoc") cfg.assoc = num;
+            else if(key == "line") cfg.line = num;
+            else if(key == "latency") cfg.latency = num;
+            else if(key == "mshr") cfg.mshr = num;
+            else return 0;
+        }
+        if(cfg.line & (cfg.line - 1)) return 0;
+        return cfg.size % (cfg.line * cfg.assoc) == 0;
+    }
+};
+
+// set-associative, write-back, write-allocate cache with non-blocking misses
+class Cache: public Memory_level {
+private:
+    struct Line {
+        addr_t tag;
+        bool valid, dirty;
+        long long stamp;    // last use (lru) or fill time (fifo)
+    };
+    struct Mshr {
+        bool busy;
+        addr_t line;
+        bool dirty;
+        int lower;          // ticket of the fill request, -1 until the lower level accepted it
+    };
+
+    std::string name;
+    Cache_config cfg;
+    Memory_level *next;
+    int sets, line_bits;
+    std::vector<Line> lines;
+    std::vector<Mshr> mshr;
+    std::vector<addr_t> writeback;      // victims the lower level has not accepted yet
+    Ticket_pool pool;
+    long long now;
+    word seed;
+
+    long long hits, misses, merges, blocked, evicts, wbs;
+
+    Line* lookup(addr_t line) {
+        Line *set = &lines[size_t(line % sets) * cfg.assoc];
+        for(int i = 0; i < cfg.assoc; ++i) {
+            if(set[i].valid && set[i].tag == line) return &set[i];
+        }
+        return nullptr;
+    }
+
+    Line* victim(addr_t line) {
+        Line *set = &lines[size_t(line % sets) * cfg.assoc];
+        for(int i = 0; i < cfg.assoc; ++i) {
+            if(!set[i].valid) return &set[i];
+        }
+        if(cfg.policy == "random") {
+            seed = seed * 1103515245 + 12345;
+            return &set[(seed >> 16) % cfg.assoc];
+        }
+        Line *ret = &set[0];
+        for(int i = 1; i < cfg.assoc; ++i) {
+            if(set[i].stamp < ret->stamp) ret = &set[i];
+        }
+        return ret;
+    }
+
+    void fill(const Mshr &entry) {
+        Line *line = victim(entry.line);
+        if(line->valid) {
+            evicts++;
+            if(line->dirty) wbs++, writeback.push_back(line->tag << line_bits);
+        }
+        line->tag = entry.line;
+        line->valid = 1, line->dirty = entry.dirty;
+        line->stamp = now;
+    }
+
+public:
+    Cache(const std::string &nm, const Cache_config &config, Memory_level *lower):
+        name(nm), cfg(config), next(lower), now(0), seed(1),
+        hits(0), misses(0), merges(0), blocked(0), evicts(0), wbs(0) {
+        if(cfg.assoc <= 0) cfg.assoc = 1;
+        sets = cfg.size / cfg.line / cfg.assoc;
+        line_bits = 0;
+        while((1 << line_bits) < cfg.line) line_bits++;
+        lines.assign(size_t(sets) * cfg.assoc, Line{0, 0, 0, 0});
+        mshr.assign(cfg.mshr, Mshr{0, 0, 0, -1});
+    }
+
+    int line_size() const {return cfg.line; }
+
+    int request(addr_t addr, bool write) override {
+        addr_t line = addr >> line_bits;
+        Line *hit = lookup(line);
+        if(hit) {
+            hits++;
+            if(cfg.policy == "lru") hit->stamp = now;
+            hit->dirty |= write;
+            return pool.allocate(now + cfg.latency);
+        }
+        for(int i = 0; i < cfg.mshr; ++i) {
+            if(mshr[i].busy && mshr[i].line == line) {
+                misses++, merges++;
+                mshr[i].dirty |= write;
+                return pool.allocate(-1, i);
+            }
+        }
+        for(int i = 0; i < cfg.mshr; ++i) {
+            if(!mshr[i].busy) {
+                misses++;
+                mshr[i] = Mshr{1, line, write, next->request(line << line_bits, 0)};
+                return pool.allocate(-1, i);
+            }
+        }
+        blocked++;
+        return -1;
+    }
+
+    bool ready(int ticket) override {return pool.done(ticket, now); }
+    void release(int ticket) override {pool.free(ticket); }
+
+    void tick() override {
+        now++;
+        for(int i = 0; i < cfg.mshr; ++i) {
+            auto &entry = mshr[i];
+            if(!entry.busy) continue;
+            if(entry.lower < 0) {
+                entry.lower = next->request(entry.line << line_bits, 0);
+                continue;
+            }
+            if(!next->ready(entry.lower)) continue;
+            next->release(entry.lower);
+            fill(entry);
+            pool.wake(i, now + cfg.latency);
+            entry.busy = 0;
+        }
+        while(!writeback.empty()) {
+            int ticket = next->request(writeback.back(), 1);
+            if(ticket < 0) break;
+            next->release(ticket), writeback.pop_back();
+        }
+    }
+
+    void report(std::ostream &os) override {
+        long long total = hits + misses;
+        os << "[" << name << "] ";
+        if(cfg.size % 1024) os << cfg.size << "B ";
+        else os << cfg.size / 1024 << "K ";
+        os << cfg.assoc << "-way " << cfg.line << "B";
+        os << " hit " << hits << " miss " << misses << " (merged " << merges << ")";
+        os << " miss-rate " << (total? 1.0 * misses / total: 0.0);
+        os << " mshr-full " << blocked << " evict " << evicts << " writeback " << wbs << '\n';
+    }
+};
+
+}
+
+#endif
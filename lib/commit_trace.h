@@ -0,0 +1,283 @@
+#ifndef __RISCV_SIMULATOR_COMMIT_TRACE_H__
+#define __RISCV_SIMULATOR_COMMIT_TRACE_H__
+
+#include "utils.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+namespace riscv {
+
+// trace layout: "RVCT" followed by one record per committed instruction, each a flag byte
+//   bit 0, 1   pc is the previous pc of the thread + 4, + 2; otherwise varint zigzag(pc - previous pc)
+//   bit 2      the instruction word is the one last seen at this pc (a 64K-entry direct-mapped
+//              table both ends keep); otherwise its 4 bytes follow, little-endian
+//   bit 3      writes a register: a byte with the register (32 to 63 are f0 to f31), then
+//              varint zigzag(value - the register's previous value)
+//   bit 4, 5   1 load, 2 store: a byte with the access size, varint zigzag(addr - the thread's
+//              previous address), and for stores varint of the data
+//   bit 6      hardware thread 1 of the core
+// the instruction word is the expanded one for compressed instructions; the file ends at eof
+
+struct Commit_record {
+    addr_t pc;
+    inst_t org;
+    word value;         // written to rd
+    addr_t addr;        // of the memory access
+    word data;          // stored
+    byte thread, rd;    // rd 0 for none
+    byte mem, size;     // mem: 0 none, 1 load, 2 store
+};
+
+// shared by the encoder and the decoder, which evolve it identically
+class Commit_trace_state {
+protected:
+    const static int TABLE = 1 << 16;
+    struct Slot {
+        addr_t pc;
+        inst_t org;
+    };
+    std::vector<Slot> table;
+    addr_t last_pc[2], last_addr[2];
+    word regs[2][64];
+
+    Commit_trace_state(): table(TABLE, Slot{~0u, 0}) {
+        for(int i = 0; i < 2; ++i) {
+            last_pc[i] = last_addr[i] = 0;
+            for(auto &r: regs[i]) r = 0;
+        }
+    }
+    Slot& slot(addr_t pc) {return table[pc >> 1 & (TABLE - 1)]; }
+
+    static word zigzag(word delta) {
+        return (delta << 1) ^ word(int(delta) >> 31);
+    }
+    static word unzigzag(word val) {
+        return (val >> 1) ^ -(val & 1);
+    }
+};
+
+// lock-free ring between one producer and one consumer thread; each side caches the
+// other's index and rereads it only when the ring looks full or empty, and the producer
+// publishes its pushes every BATCH items or on publish(), so the consumer wakes up to batches.
+// the groups of fields written by different threads are 64 bytes apart, padded by hand since
+// alignas would make every class holding a ring over-aligned, which plain new does not honour
+// before c++17
+template <typename T, size_t N>
+class Spsc_ring {
+private:
+    const static size_t BATCH = 64;
+    const static size_t LINE = 64;
+
+    std::vector<T> slot;
+    char pad0[LINE];
+    std::atomic<size_t> head;               // next to pop, advanced by the consumer
+    char pad1[LINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;               // next to push as the consumer sees it
+    char pad2[LINE - sizeof(std::atomic<size_t>)];
+    size_t head_seen;                       // producer's copy of head
+    size_t next;                            // producer's own tail
+    char pad3[LINE - 2 * sizeof(size_t)];
+    size_t tail_seen;                       // consumer's copy of tail
+    char pad4[LINE - sizeof(size_t)];
+
+public:
+    Spsc_ring(): slot(N), head(0), tail(0), head_seen(0), next(0), tail_seen(0) {}
+
+    bool push(const T &item) {
+        if(next - head_seen == N) {
+            publish();
+            head_seen = head.load(std::memory_order_acquire);
+            if(next - head_seen == N) return 0;
+        }
+        slot[next++ % N] = item;
+        if(next % BATCH == 0) publish();
+        return 1;
+    }
+    void publish() {tail.store(next, std::memory_order_release); }
+    bool pop(T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h == tail_seen) {
+            tail_seen = tail.load(std::memory_order_acquire);
+            if(h == tail_seen) return 0;
+        }
+        item = slot[h % N];
+        head.store(h + 1, std::memory_order_release);
+        return 1;
+    }
+};
+
+// commit() pushes records into the ring, and a writer thread encodes and writes them
+class Commit_trace_writer: private Commit_trace_state {
+private:
+    const static size_t RING = 1 << 14;
+
+    FILE *fp;
+    Spsc_ring<Commit_record, RING> ring;
+    std::atomic<bool> done;
+    std::thread worker;
+    std::vector<byte> buf;
+
+    void put(word val) {
+        while(val >= 128) buf.push_back(val & 127 | 128), val >>= 7;
+        buf.push_back(val);
+    }
+
+    void encode(const Commit_record &rec) {
+        int th = rec.thread & 1;
+        byte flags = th << 6 | rec.mem << 4;
+        size_t at = buf.size();
+        buf.push_back(0);
+        if(rec.pc == last_pc[th] + 4) flags |= 1;
+        else if(rec.pc == last_pc[th] + 2) flags |= 2;
+        else put(zigzag(rec.pc - last_pc[th]));
+        last_pc[th] = rec.pc;
+        auto &s = slot(rec.pc);
+        if(s.pc == rec.pc && s.org == rec.org) flags |= 4;
+        else {
+            for(int i = 0; i < 4; ++i) buf.push_back(rec.org >> 8 * i);
+            s = Slot{rec.pc, rec.org};
+        }
+        if(rec.rd) {
+            flags |= 8;
+            buf.push_back(rec.rd);
+            put(zigzag(rec.value - regs[th][rec.rd & 63]));
+            regs[th][rec.rd & 63] = rec.value;
+        }
+        if(rec.mem) {
+            buf.push_back(rec.size);
+            put(zigzag(rec.addr - last_addr[th]));
+            last_addr[th] = rec.addr;
+            if(rec.mem == 2) put(rec.data);
+        }
+        buf[at] = flags;
+    }
+
+    void drain() {
+        Commit_record rec;
+        while(true) {
+            bool stop = done.load(std::memory_order_acquire);
+            int n = 0;
+            while(n < 4096 && ring.pop(rec)) encode(rec), n++;
+            if(buf.size() >= (1 << 16) || (stop && !n)) {
+                if(!buf.empty()) fwrite(buf.data(), 1, buf.size(), fp);
+                buf.clear();
+            }
+            if(stop && !n) return ;
+            if(!n) std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+    }
+
+public:
+    Commit_trace_writer(): fp(nullptr), done(0) {}
+    ~Commit_trace_writer() {close(); }
+
+    bool open(const std::string &path) {
+        fp = fopen(path.c_str(), "wb");
+        if(!fp) return 0;
+        fwrite("RVCT", 1, 4, fp);
+        done = 0;
+        worker = std::thread([this]() {drain(); });
+        return 1;
+    }
+    bool opened() {return fp != nullptr; }
+
+    // waits for the writer only when the ring is full
+    void record(const Commit_record &rec) {
+        while(!ring.push(rec)) std::this_thread::yield();
+    }
+
+    void close() {
+        if(!fp) return ;
+        ring.publish();
+        done.store(1, std::memory_order_release);
+        worker.join();
+        fclose(fp);
+        fp = nullptr;
+    }
+};
+
+// reads a trace back record by record, through a fixed-size buffer
+class Commit_trace_reader: private Commit_trace_state {
+private:
+    FILE *fp;
+    std::vector<byte> buf;
+    size_t pos, len;
+
+    bool get(byte &b) {
+        if(pos == len) {
+            len = fp? fread(buf.data(), 1, buf.size(), fp): 0, pos = 0;
+            if(!len) return 0;
+        }
+        b = buf[pos++];
+        return 1;
+    }
+    bool get(word &val) {
+        val = 0;
+        byte b;
+        for(int sh = 0; sh < 35; sh += 7) {
+            if(!get(b)) return 0;
+            val |= word(b & 127) << sh;
+            if(!(b & 128)) return 1;
+        }
+        return 0;
+    }
+
+public:
+    Commit_trace_reader(): fp(nullptr), buf(1 << 16), pos(0), len(0) {}
+    ~Commit_trace_reader() {
+        if(fp) fclose(fp);
+    }
+
+    bool open(const std::string &path) {
+        fp = fopen(path.c_str(), "rb");
+        if(!fp) return 0;
+        char magic[4];
+        return fread(magic, 1, 4, fp) == 4 && std::string(magic, 4) == "RVCT";
+    }
+
+    // false at the end of the trace, or at a truncated record
+    bool next(Commit_record &rec) {
+        byte flags, b;
+        word val;
+        if(!get(flags)) return 0;
+        int th = flags >> 6 & 1;
+        rec.thread = th;
+        if(flags & 1) rec.pc = last_pc[th] + 4;
+        else if(flags & 2) rec.pc = last_pc[th] + 2;
+        else {
+            if(!get(val)) return 0;
+            rec.pc = last_pc[th] + unzigzag(val);
+        }
+        last_pc[th] = rec.pc;
+        auto &s = slot(rec.pc);
+        if(flags & 4) rec.org = s.org;
+        else {
+            rec.org = 0;
+            for(int i = 0; i < 4; ++i) {
+                if(!get(b)) return 0;
+                rec.org |= inst_t(b) << 8 * i;
+            }
+            s = Slot{rec.pc, rec.org};
+        }
+        rec.rd = 0, rec.value = 0;
+        if(flags & 8) {
+            if(!get(rec.rd) || !get(val)) return 0;
+            rec.value = regs[th][rec.rd & 63] += unzigzag(val);
+        }
+        rec.mem = flags >> 4 & 3, rec.size = 0, rec.addr = rec.data = 0;
+        if(rec.mem) {
+            if(!get(rec.size) || !get(val)) return 0;
+            rec.addr = last_addr[th] += unzigzag(val);
+            if(rec.mem == 2 && !get(rec.data)) return 0;
+        }
+        return 1;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef __RISCV_SIMULATOR_DRAM_H__
+#define __RISCV_SIMULATOR_DRAM_H__
+
+#include "utils.h"
+#include "cache.h"
+#include <vector>
+#include <deque>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+
+namespace riscv {
+
+struct Dram_config {
+    int channels, banks, row;   // row: bytes per row (per bank)
+    bool open_page;
+    int tRCD, tCAS, tRP, tRAS, tBURST;
+    int queue;                  // request queue depth per channel
+
+    Dram_config(): channels(1), banks(8), row(2048), open_page(1),
+        tRCD(14), tCAS(14), tRP(14), tRAS(34), tBURST(4), queue(32) {}
+
+    // parse "key=val,..." with keys channels, banks, row, policy (open, closed),
+    // tRCD, tCAS, tRP, tRAS, tBURST, queue
+    static bool parse(const std::string &spec, Dram_config &cfg) {
+        std::stringstream ss(spec);
+        std::string item;
+        while(std::getline(ss, item, ',')) {
+            auto eq = item.find('=');
+            if(eq == std::string::npos) return 0;
+            auto key = item.substr(0, eq), val = item.substr(eq + 1);
+            if(key == "policy") {
+                if(val != "open" && val != "closed") return 0;
+                cfg.open_page = val == "open"; continue;
+            }
+            char *end;
+            long num = std::strtol(val.c_str(), &end, 10);
+            if(*end == 'K' || *end == 'k') num <<= 10, end++;
+            if(*end || num <= 0) return 0;
+            if(key == "channels") cfg.channels = num;
+            else if(key == "banks") cfg.banks = num;
+            else if(key == "row") cfg.row = num;
+            else if(key == "tRCD") cfg.tRCD = num;
+            else if(key == "tCAS") cfg.tCAS = num;
+            else if(key == "tRP") cfg.tRP = num;
+            else if(key == "tRAS") cfg.tRAS = num;
+            else if(key == "tBURST") cfg.tBURST = num;
+            else if(key == "queue") cfg.queue = num;
+            else return 0;
+        }
+        return 1;
+    }
+};
+
+// DRAM controller with per-bank row buffers and FR-FCFS scheduling;
+// address layout is row : bank : channel : column
+class Dram: public Memory_level {
+private:
+    struct Request {
+        int ticket;
+        bool write, orphan;
+        int bank;
+        long long row;
+        long long arrive;
+    };
+    struct Bank {
+        long long row;          // open row, -1 when precharged
+        long long ready;        // next cycle a command may be issued
+        long long act;          // last activation, bounds the next precharge by tRAS
+    };
+    struct Channel {
+        std::deque<Request> que;
+        std::vector<Bank> bank;
+        long long bus;          // data bus free from this cycle
+    };
+
+    Dram_config cfg;
+    std::vector<Channel> chan;
+    Ticket_pool pool;
+    long long now;
+
+    long long reads, writes, row_hits, row_empty, row_conflicts, served, total_lat, blocked;
+
+    void decode(addr_t addr, int &ch, int &bank, long long &row) {
+        long long block = addr / cfg.row;
+        ch = block % cfg.channels, block /= cfg.channels;
+        bank = block % cfg.banks, row = block / cfg.banks;
+    }
+
+    // issues the commands of a request, returns the cycle its burst completes
+    long long service(Channel &c, Request &req) {
+        auto &b = c.bank[req.bank];
+        long long start = std::max(now, b.ready), col;
+        if(b.row == req.row) col = start;
+        else if(b.row < 0) col = start + cfg.tRCD;
+        else col = std::max(start, b.act + cfg.tRAS) + cfg.tRP + cfg.tRCD;
+        long long data = std::max(col + cfg.tCAS, c.bus);
+        if(b.row == req.row) row_hits++;
+        else if(b.row < 0) row_empty++;
+        else row_conflicts++;
+        if(b.row != req.row) b.act = col - cfg.tRCD;
+        c.bus = data + cfg.tBURST;
+        b.ready = col + cfg.tBURST;
+        b.row = req.row;
+        if(!cfg.open_page) {
+            // auto-precharge once the burst is out
+            b.ready = std::max(data + cfg.tBURST, b.act + cfg.tRAS) + cfg.tRP;
+            b.row = -1;
+        }
+        return data + cfg.tBURST;
+    }
+
+    void schedule(Channel &c) {
+        if(c.que.empty()) return ;
+        // first ready: the oldest row hit to an idle bank, otherwise the oldest request to an idle bank
+        int pick = -1;
+        for(int i = 0; i < int(c.que.size()); ++i) {
+            auto &b = c.bank[c.que[i].bank];
+            if(b.ready > now) continue;
+            if(b.row == c.que[i].row) {pick = i; break; }
+            if(pick < 0) pick = i;
+        }
+        if(pick < 0) return ;
+        auto req = c.que[pick];
+        c.que.erase(c.que.begin() + pick);
+        long long done = service(c, req);
+        served++, total_lat += done - req.arrive;
+        if(!req.orphan) pool.set(req.ticket, done);
+    }
+
+public:
+    explicit Dram(const Dram_config &config): cfg(config), now(0),
+        reads(0), writes(0), row_hits(0), row_empty(0), row_conflicts(0), served(0), total_lat(0), blocked(0) {
+        chan.resize(cfg.channels);
+        for(auto &c: chan) {
+            c.bank.assign(cfg.banks, Bank{-1, 0, 0});
+            c.bus = 0;
+        }
+    }
+
+    int request(addr_t addr, bool write) override {
+        int ch, bank;
+        long long row;
+        decode(addr, ch, bank, row);
+        auto &c = chan[ch];
+        if(int(c.que.size()) >= cfg.queue) {blocked++; return -1; }
+        if(write) writes++; else reads++;
+        int ticket = pool.allocate(-1);
+        c.que.push_back(Request{ticket, write, 0, bank, row, now});
+        return ticket;
+    }
+
+    bool ready(int ticket) override {return pool.done(ticket, now); }
+
+    void release(int ticket) override {
+        for(auto &c: chan) {
+            for(auto &req: c.que) {
+                if(req.ticket == ticket && !req.orphan) req.orphan = 1;
+            }
+        }
+        pool.free(ticket);
+    }
+
+    void tick() override {
+        for(auto &c: chan) schedule(c);
+        now++;
+    }
+
+    void report(std::ostream &os) override {
+        os << "[dram] " << cfg.channels << "ch " << cfg.banks << " banks " << (cfg.open_page? "open": "closed") << "-page";
+        os << " read " << reads << " write " << writes;
+        os << " row-hit " << row_hits << " row-empty " << row_empty << " row-conflict " << row_conflicts;
+        os << " avg-latency " << (served? 1.0 * total_lat / served: 0.0) << " queue-full " << blocked << '\n';
+    }
+};
+
+}
+
+#endif
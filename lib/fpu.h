@@ -0,0 +1,299 @@
+#ifndef __RISCV_SIMULATOR_FPU_H__
+#define __RISCV_SIMULATOR_FPU_H__
+
+#include "utils.h"
+#include "inst.h"
+#include <cstring>
+#include <cstdint>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define RISCV_SIMULATOR_SSE_FPU 1
+#endif
+
+namespace riscv {
+
+// fflags bits
+enum Fp_flag {
+    FP_NX = 1, FP_UF = 2, FP_OF = 4, FP_DZ = 8, FP_NV = 16
+};
+
+// rounding modes of the rm field and frm
+enum Fp_round {
+    RNE = 0, RTZ, RDN, RUP, RMM
+};
+
+// RV32F on raw single-precision bit patterns. Sign injection, comparisons, min/max,
+// classification and float-to-int conversions are bit manipulation; the arithmetic runs on
+// the host's sse unit in double precision with round-to-odd (round toward zero, and the last
+// bit set when inexact), which holds enough bits for the final rounding to single precision in
+// the requested mode to be correct. mxcsr is set up for every operation, so the host's own
+// flush-to-zero settings do not leak in, and its exception flags become fflags
+class FPU {
+public:
+    const static word CANONICAL_NAN = 0x7fc00000;
+    const static word SIGN = 0x80000000;
+
+    static bool is_nan(word x) {return (x & 0x7fffffff) > 0x7f800000; }
+    static bool is_snan(word x) {return is_nan(x) && !(x & 0x00400000); }
+    static bool is_zero(word x) {return !(x & 0x7fffffff); }
+
+private:
+    // total order of the non-nan values, both zeros equal
+    static long long key(word x) {
+        return x & SIGN? -(long long)(x & 0x7fffffff): (long long)x;
+    }
+
+    static word fclass(word x) {
+        bool neg = x & SIGN;
+        word exp = x >> 23 & 255, man = x & 0x7fffff;
+        if(exp == 255) {
+            if(!man) return neg? 1 << 0: 1 << 7;
+            return man & 0x400000? 1 << 9: 1 << 8;
+        }
+        if(!exp) {
+            if(!man) return neg? 1 << 3: 1 << 4;
+            return neg? 1 << 2: 1 << 5;
+        }
+        return neg? 1 << 1: 1 << 6;
+    }
+
+    static word min_max(bool max, word a, word b, word &flags) {
+        if(is_snan(a) || is_snan(b)) flags |= FP_NV;
+        if(is_nan(a) && is_nan(b)) return CANONICAL_NAN;
+        if(is_nan(a)) return b;
+        if(is_nan(b)) return a;
+        // -0 is below +0 here
+        if(is_zero(a) && is_zero(b)) return max? a & b: a | b;
+        return (key(a) < key(b)) == max? b: a;
+    }
+
+    static word compare(RV32I_Opt opt, word a, word b, word &flags) {
+        if(is_nan(a) || is_nan(b)) {
+            // feq is quiet, flt and fle signal on any nan
+            if(opt != FEQ_S || is_snan(a) || is_snan(b)) flags |= FP_NV;
+            return 0;
+        }
+        switch(opt) {
+            case FEQ_S: return key(a) == key(b);
+            case FLT_S: return key(a) < key(b);
+            default: return key(a) <= key(b);
+        }
+    }
+
+    // float to 32-bit integer, saturating with nv when out of range
+    static word to_int(word x, int rm, bool is_unsigned, word &flags) {
+        word big = is_unsigned? ~0u: 0x7fffffffu, small = is_unsigned? 0u: 0x80000000u;
+        if(is_nan(x)) {
+            flags |= FP_NV;
+            return big;
+        }
+        bool neg = x & SIGN;
+        int exp = x >> 23 & 255;
+        uint64_t man = x & 0x7fffff;
+        if(exp == 255) {
+            flags |= FP_NV;
+            return neg? small: big;
+        }
+        if(exp) man |= 0x800000;
+        // the value is man * 2^shift
+        int shift = (exp? exp: 1) - 150;
+        uint64_t mag = 0;
+        bool inexact = 0;
+        if(shift >= 0) mag = shift > 32? uint64_t(1) << 40: man << shift;
+        else {
+            int k = -shift;
+            // anything below 2^-25 only matters for being nonzero
+            if(k > 25) man = man? 1: 0, k = 25;
+            uint64_t rem = man & ((uint64_t(1) << k) - 1), half = uint64_t(1) << (k - 1);
+            mag = man >> k;
+            inexact = rem;
+            bool up = 0;
+            switch(rm) {
+                case RTZ: break;
+                case RDN: up = neg && rem; break;
+                case RUP: up = !neg && rem; break;
+                case RMM: up = rem >= half; break;
+                default: up = rem > half || (rem == half && (mag & 1)); break;
+            }
+            mag += up;
+        }
+        if(is_unsigned) {
+            if((neg && mag) || mag > 0xffffffffu) {
+                flags |= FP_NV;
+                return neg? small: big;
+            }
+        }
+        else if(mag > (neg? 0x80000000u: 0x7fffffffu)) {
+            flags |= FP_NV;
+            return neg? small: big;
+        }
+        if(inexact) flags |= FP_NX;
+        return neg? word(-mag): word(mag);
+    }
+
+#ifdef RISCV_SIMULATOR_SSE_FPU
+    // every exception masked, flags clear, no flush-to-zero nor denormals-are-zero
+    static unsigned csr(int rm) {
+        switch(rm) {
+            case RTZ: return 0x1f80 | 0x6000;
+            case RDN: return 0x1f80 | 0x2000;
+            case RUP: return 0x1f80 | 0x4000;
+            default: return 0x1f80;
+        }
+    }
+    static word host_flags(unsigned st) {
+        word flags = 0;
+        if(st & 0x01) flags |= FP_NV;
+        if(st & 0x04) flags |= FP_DZ;
+        if(st & 0x08) flags |= FP_OF;
+        if(st & 0x10) flags |= FP_UF;
+        if(st & 0x20) flags |= FP_NX;
+        return flags;
+    }
+    // keep the compiler from moving arithmetic across the mxcsr accesses
+    static void pin(__m128d &x) {asm volatile("" : "+x"(x)); }
+    static void pin(__m128 &x) {asm volatile("" : "+x"(x)); }
+
+    // exact single to double conversion in integer arithmetic, so that neither denormals-are-zero
+    // nor the flags of a signaling nan get in the way; the nan stays signaling
+    static __m128d widen(word x) {
+        uint64_t sign = uint64_t(x >> 31) << 63, man = x & 0x7fffff;
+        int exp = x >> 23 & 255;
+        uint64_t raw;
+        if(exp == 255) raw = sign | uint64_t(0x7ff) << 52 | man << 29;
+        else if(exp) raw = sign | uint64_t(exp + 896) << 52 | man << 29;
+        else if(!man) raw = sign;
+        else {
+            int shift = __builtin_clz(man) - 8;
+            raw = sign | uint64_t(897 - shift) << 52 | (man << shift & 0x7fffff) << 29;
+        }
+        double d;
+        std::memcpy(&d, &raw, 8);
+        return _mm_set_sd(d);
+    }
+    static word bits(__m128 x) {
+        float f = _mm_cvtss_f32(x);
+        word w;
+        std::memcpy(&w, &f, 4);
+        return w;
+    }
+
+    // round `d` to single precision, ties away from zero for rmm
+    static word narrow(__m128d d, int rm, word &flags) {
+        _mm_setcsr(csr(rm));
+        pin(d);
+        __m128 r = _mm_cvtsd_ss(_mm_setzero_ps(), d);
+        pin(r);
+        flags |= host_flags(_mm_getcsr());
+        word res = bits(r);
+        if(rm != RMM || !(flags & FP_NX) || is_nan(res)) return res;
+        // a tie went to the even neighbour, which is wrong when that one is nearer zero
+        _mm_setcsr(csr(RTZ));
+        pin(d);
+        __m128 low = _mm_cvtsd_ss(_mm_setzero_ps(), d);
+        pin(low);
+        word lo = bits(low), hi = lo + 1;
+        if((hi & 0x7f800000) == 0x7f800000) return res;
+        __m128d mid = _mm_mul_sd(_mm_add_sd(widen(lo), widen(hi)), _mm_set_sd(0.5));
+        pin(mid);
+        return _mm_ucomieq_sd(mid, d)? hi: res;
+    }
+
+    static word arith(RV32I_Opt opt, word a, word b, word c, int rm, word &flags) {
+        unsigned saved = _mm_getcsr();
+        word res;
+        if(opt == FCVT_S_W || opt == FCVT_S_WU) {
+            // every 32-bit integer is exact in double
+            __m128d d = _mm_set_sd(opt == FCVT_S_W? double(int32_t(a)): double(a));
+            res = narrow(d, rm, flags);
+        }
+        else {
+            __m128d x = widen(a), y = widen(b), z = widen(c);
+            _mm_setcsr(csr(RTZ));
+            pin(x), pin(y), pin(z);
+            __m128d d;
+            switch(opt) {
+                case FADD_S: d = _mm_add_sd(x, y); break;
+                case FSUB_S: d = _mm_sub_sd(x, y); break;
+                case FMUL_S: d = _mm_mul_sd(x, y); break;
+                case FDIV_S: d = _mm_div_sd(x, y); break;
+                case FSQRT_S: d = _mm_sqrt_sd(x, x); break;
+                // the product of two singles is exact in double, so only the sum rounds
+                default: d = _mm_add_sd(_mm_mul_sd(x, y), z); break;
+            }
+            pin(d);
+            unsigned st = _mm_getcsr();
+            flags |= host_flags(st & 0x05);
+            uint64_t raw;
+            std::memcpy(&raw, &d, 8);
+            if(!(st & 0x20) && opt != FSQRT_S) {
+                // exact: the sign of a zero sum depends on the rounding mode, so redo it in that one
+                _mm_setcsr(csr(rm));
+                pin(x), pin(y), pin(z);
+                switch(opt) {
+                    case FADD_S: d = _mm_add_sd(x, y); break;
+                    case FSUB_S: d = _mm_sub_sd(x, y); break;
+                    case FMUL_S: case FDIV_S: break;
+                    default: d = _mm_add_sd(_mm_mul_sd(x, y), z); break;
+                }
+                pin(d);
+            }
+            else if((st & 0x20) && (raw & 0x7ff0000000000000ull) != 0x7ff0000000000000ull) {
+                raw |= 1;
+                std::memcpy(&d, &raw, 8);
+            }
+            res = narrow(d, rm, flags);
+        }
+        _mm_setcsr(saved);
+        return res;
+    }
+#else
+    // other hosts round to nearest even and raise no flags
+    static word arith(RV32I_Opt opt, word a, word b, word c, int rm, word &flags) {
+        float x, y, z, r;
+        std::memcpy(&x, &a, 4), std::memcpy(&y, &b, 4), std::memcpy(&z, &c, 4);
+        switch(opt) {
+            case FADD_S: r = x + y; break;
+            case FSUB_S: r = x - y; break;
+            case FMUL_S: r = x * y; break;
+            case FDIV_S: r = x / y; break;
+            case FSQRT_S: r = __builtin_sqrtf(x); break;
+            case FCVT_S_W: r = float(int32_t(a)); break;
+            case FCVT_S_WU: r = float(a); break;
+            default: r = float(double(x) * y + z); break;
+        }
+        word res;
+        std::memcpy(&res, &r, 4);
+        return res;
+    }
+#endif
+
+public:
+    // result of `opt`, the fflags it raises are or-ed into `flags`
+    word calc(RV32I_Opt opt, word a, word b, word c, int rm, word &flags) {
+        switch(opt) {
+            case FSGNJ_S: return (a & ~SIGN) | (b & SIGN);
+            case FSGNJN_S: return (a & ~SIGN) | (~b & SIGN);
+            case FSGNJX_S: return a ^ (b & SIGN);
+            case FMIN_S: return min_max(0, a, b, flags);
+            case FMAX_S: return min_max(1, a, b, flags);
+            case FEQ_S: case FLT_S: case FLE_S: return compare(opt, a, b, flags);
+            case FCLASS_S: return fclass(a);
+            case FMV_X_W: case FMV_W_X: return a;
+            case FCVT_W_S: return to_int(a, rm, 0, flags);
+            case FCVT_WU_S: return to_int(a, rm, 1, flags);
+            // the negated forms flip the sign of the product or the addend
+            case FMSUB_S: c ^= SIGN; break;
+            case FNMSUB_S: a ^= SIGN; break;
+            case FNMADD_S: a ^= SIGN, c ^= SIGN; break;
+            default: break;
+        }
+        if(opt == FMADD_S || opt == FMSUB_S || opt == FNMSUB_S || opt == FNMADD_S) opt = FMADD_S;
+        word res = arith(opt, a, b, c, rm, flags);
+        return is_nan(res)? CANONICAL_NAN: res;
+    }
+};
+
+}
+
+#endif
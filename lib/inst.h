@@ -20,11 +20,11 @@ enum RV32I_Opt {
     BRANCH_END,
 
     LOAD_BEG = 48,
-        LB, LH, LW, LBU, LHU,
+        LB, LH, LW, LBU, LHU, FLW,
     LOAD_END,
 
     STORE_BEG = 64,
-        SB, SH, SW,
+        SB, SH, SW, FSW,
     STORE_END,
 
     IMM_BEG = 80,
@@ -33,7 +33,38 @@ enum RV32I_Opt {
 
     REG_BE = 96,
         ADD, SUB, SLL, SLT, SLTU, SRL, SRA, XOR, OR, AND,
-    REG_END
+    REG_END,
+
+    AMO_BEG = 112,
+        LR_W, SC_W, AMOSWAP_W, AMOADD_W, AMOXOR_W, AMOAND_W, AMOOR_W,
+        AMOMIN_W, AMOMAX_W, AMOMINU_W, AMOMAXU_W,
+    AMO_END,
+
+    MUL_BEG = 128,
+        MUL, MULH, MULHSU, MULHU, DIV, DIVU, REM, REMU,
+    MUL_END,
+
+    SYS_BEG = 144,
+        FENCE, ECALL, CSRRW, CSRRS, CSRRC, CSRRWI, CSRRSI, CSRRCI,
+    SYS_END,
+
+    // vector subset, the element width of loads and stores is in funct3, the operand form of the rest too
+    VECTOR_BEG = 160,
+        VSETVLI, VSETIVLI, VSETVL,
+        VLE, VLSE, VSE, VSSE,
+        VADD, VSUB, VRSUB, VAND, VOR, VXOR, VMINU, VMIN, VMAXU, VMAX, VMUL, VMV,
+        VREDSUM, VREDAND, VREDOR, VREDXOR, VREDMINU, VREDMIN, VREDMAXU, VREDMAX,
+        VMV_X_S, VMV_S_X,
+    VECTOR_END,
+
+    // single-precision arithmetic, the rounding mode is in funct3
+    FP_BEG = 192,
+        FMADD_S, FMSUB_S, FNMSUB_S, FNMADD_S,
+        FADD_S, FSUB_S, FMUL_S, FDIV_S, FSQRT_S,
+        FSGNJ_S, FSGNJN_S, FSGNJX_S, FMIN_S, FMAX_S,
+        FCVT_W_S, FCVT_WU_S, FMV_X_W, FEQ_S, FLT_S, FLE_S, FCLASS_S,
+        FCVT_S_W, FCVT_S_WU, FMV_W_X,
+    FP_END
     
 };
 
@@ -76,6 +107,88 @@ std::string opt_to_string(RV32I_Opt opt) {
         case XOR: return "xor";
         case OR: return "or";
         case AND: return "and";
+        case MUL: return "mul";
+        case MULH: return "mulh";
+        case MULHSU: return "mulhsu";
+        case MULHU: return "mulhu";
+        case DIV: return "div";
+        case DIVU: return "divu";
+        case REM: return "rem";
+        case REMU: return "remu";
+        case LR_W: return "lr.w";
+        case SC_W: return "sc.w";
+        case AMOSWAP_W: return "amoswap.w";
+        case AMOADD_W: return "amoadd.w";
+        case AMOXOR_W: return "amoxor.w";
+        case AMOAND_W: return "amoand.w";
+        case AMOOR_W: return "amoor.w";
+        case AMOMIN_W: return "amomin.w";
+        case AMOMAX_W: return "amomax.w";
+        case AMOMINU_W: return "amominu.w";
+        case AMOMAXU_W: return "amomaxu.w";
+        case FENCE: return "fence";
+        case ECALL: return "ecall";
+        case CSRRW: return "csrrw";
+        case CSRRS: return "csrrs";
+        case CSRRC: return "csrrc";
+        case CSRRWI: return "csrrwi";
+        case CSRRSI: return "csrrsi";
+        case CSRRCI: return "csrrci";
+        case VSETVLI: return "vsetvli";
+        case VSETIVLI: return "vsetivli";
+        case VSETVL: return "vsetvl";
+        case VLE: return "vle.v";
+        case VLSE: return "vlse.v";
+        case VSE: return "vse.v";
+        case VSSE: return "vsse.v";
+        case VADD: return "vadd";
+        case VSUB: return "vsub";
+        case VRSUB: return "vrsub";
+        case VAND: return "vand";
+        case VOR: return "vor";
+        case VXOR: return "vxor";
+        case VMINU: return "vminu";
+        case VMIN: return "vmin";
+        case VMAXU: return "vmaxu";
+        case VMAX: return "vmax";
+        case VMUL: return "vmul";
+        case VMV: return "vmv.v";
+        case VREDSUM: return "vredsum.vs";
+        case VREDAND: return "vredand.vs";
+        case VREDOR: return "vredor.vs";
+        case VREDXOR: return "vredxor.vs";
+        case VREDMINU: return "vredminu.vs";
+        case VREDMIN: return "vredmin.vs";
+        case VREDMAXU: return "vredmaxu.vs";
+        case VREDMAX: return "vredmax.vs";
+        case VMV_X_S: return "vmv.x.s";
+        case VMV_S_X: return "vmv.s.x";
+        case FLW: return "flw";
+        case FSW: return "fsw";
+        case FMADD_S: return "fmadd.s";
+        case FMSUB_S: return "fmsub.s";
+        case FNMSUB_S: return "fnmsub.s";
+        case FNMADD_S: return "fnmadd.s";
+        case FADD_S: return "fadd.s";
+        case FSUB_S: return "fsub.s";
+        case FMUL_S: return "fmul.s";
+        case FDIV_S: return "fdiv.s";
+        case FSQRT_S: return "fsqrt.s";
+        case FSGNJ_S: return "fsgnj.s";
+        case FSGNJN_S: return "fsgnjn.s";
+        case FSGNJX_S: return "fsgnjx.s";
+        case FMIN_S: return "fmin.s";
+        case FMAX_S: return "fmax.s";
+        case FCVT_W_S: return "fcvt.w.s";
+        case FCVT_WU_S: return "fcvt.wu.s";
+        case FMV_X_W: return "fmv.x.w";
+        case FEQ_S: return "feq.s";
+        case FLT_S: return "flt.s";
+        case FLE_S: return "fle.s";
+        case FCLASS_S: return "fclass.s";
+        case FCVT_S_W: return "fcvt.s.w";
+        case FCVT_S_WU: return "fcvt.s.wu";
+        case FMV_W_X: return "fmv.w.x";
         default: return "none"; 
     }
 }
@@ -84,13 +197,15 @@ class Decoder {
 public:
     inst_t org;
     opc_t opc;
-    rid_t rd, rs1, rs2;
+    rid_t rd, rs1, rs2, rs3;    // floating point registers are numbered from FREG up
     imm_t imm;
     func_t funct3, funct7;
 
     char type;
     RV32I_Opt opt;
 
+    const static rid_t FREG = 32;
+
     static word sext(word data, int len = 32) {
         if(len == 32) return data;
         word mask = 0xffffffff >> len << len;
@@ -166,7 +281,116 @@ private:
         return sext(imm, J_IMM_LEN);
     }
 
+    static inst_t enc_R(func_t f7, rid_t rs2, rid_t rs1, func_t f3, rid_t rd, opc_t op) {
+        return f7 << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op;
+    }
+    static inst_t enc_I(imm_t imm, rid_t rs1, func_t f3, rid_t rd, opc_t op) {
+        return slice(imm, 0, 12) << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op;
+    }
+    static inst_t enc_S(imm_t imm, rid_t rs2, rid_t rs1, func_t f3, opc_t op) {
+        return slice(imm, 5, 12) << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | slice(imm, 0, 5) << 7 | op;
+    }
+    static inst_t enc_B(imm_t imm, rid_t rs1, func_t f3) {
+        return slice(imm, 12, 13) << 31 | slice(imm, 5, 11) << 25 | rs1 << 15 | f3 << 12 | slice(imm, 1, 5) << 8 | slice(imm, 11, 12) << 7 | 0x63;
+    }
+    static inst_t enc_J(imm_t imm, rid_t rd) {
+        return slice(imm, 20, 21) << 31 | slice(imm, 1, 11) << 21 | slice(imm, 11, 12) << 20 | slice(imm, 12, 20) << 12 | rd << 7 | 0x6f;
+    }
+
 public:
+    static bool compressed(inst_t inst) {
+        return (inst & 3) != 3;
+    }
+    // element width in bits of a vector load or store, 0 for the other widths
+    static int vector_eew(func_t funct3) {
+        switch(funct3) {
+            case 0x0: return 8;
+            case 0x5: return 16;
+            case 0x6: return 32;
+            default: return 0;
+        }
+    }
+
+    // expand a 16-bit RVC instruction into the 32-bit instruction it stands for, 0 if illegal
+    static inst_t expand(inst_t c) {
+        func_t f3 = slice(c, 13, 16);
+        rid_t rd = slice(c, 7, 12), rs2 = slice(c, 2, 7);
+        rid_t rdp = slice(c, 2, 5) + 8, rs1p = slice(c, 7, 10) + 8;
+        imm_t imm = sext(slice(c, 12, 13) << 5 | slice(c, 2, 7), 6);
+        switch(c & 3) {
+            case 0: {
+                imm_t off = slice(c, 10, 13) << 3 | slice(c, 6, 7) << 2 | slice(c, 5, 6) << 6;
+                switch(f3) {
+                    case 0x0:
+                        imm = slice(c, 11, 13) << 4 | slice(c, 7, 11) << 6 | slice(c, 6, 7) << 2 | slice(c, 5, 6) << 3;
+                        return imm? enc_I(imm, 2, 0, rdp, 0x13): 0;
+                    case 0x2: return enc_I(off, rs1p, 2, rdp, 0x03);
+                    case 0x3: return enc_I(off, rs1p, 2, rdp, 0x07);
+                    case 0x6: return enc_S(off, rdp, rs1p, 2, 0x23);
+                    case 0x7: return enc_S(off, rdp, rs1p, 2, 0x27);
+                }
+                return 0;
+            }
+            case 1:
+                switch(f3) {
+                    case 0x0: return enc_I(imm, rd, 0, rd, 0x13);
+                    case 0x1: case 0x5: {
+                        imm_t off = slice(c, 12, 13) << 11 | slice(c, 11, 12) << 4 | slice(c, 9, 11) << 8 | slice(c, 8, 9) << 10;
+                        off |= slice(c, 7, 8) << 6 | slice(c, 6, 7) << 7 | slice(c, 3, 6) << 1 | slice(c, 2, 3) << 5;
+                        return enc_J(sext(off, 12), f3 == 0x1? 1: 0);
+                    }
+                    case 0x2: return enc_I(imm, 0, 0, rd, 0x13);
+                    case 0x3:
+                        if(rd == 2) {
+                            imm = slice(c, 12, 13) << 9 | slice(c, 6, 7) << 4 | slice(c, 5, 6) << 6 | slice(c, 3, 5) << 7 | slice(c, 2, 3) << 5;
+                            return imm? enc_I(sext(imm, 10), 2, 0, 2, 0x13): 0;
+                        }
+                        return imm? (imm << 12 | rd << 7 | 0x37): 0;
+                    case 0x4:
+                        switch(slice(c, 10, 12)) {
+                            case 0x0: return enc_I(imm & 31, rs1p, 5, rs1p, 0x13);
+                            case 0x1: return enc_I(imm & 31 | 0x400, rs1p, 5, rs1p, 0x13);
+                            case 0x2: return enc_I(imm, rs1p, 7, rs1p, 0x13);
+                        }
+                        if(slice(c, 12, 13)) return 0;
+                        switch(slice(c, 5, 7)) {
+                            case 0x0: return enc_R(0x20, rdp, rs1p, 0, rs1p, 0x33);
+                            case 0x1: return enc_R(0, rdp, rs1p, 4, rs1p, 0x33);
+                            case 0x2: return enc_R(0, rdp, rs1p, 6, rs1p, 0x33);
+                            case 0x3: return enc_R(0, rdp, rs1p, 7, rs1p, 0x33);
+                        }
+                        return 0;
+                    case 0x6: case 0x7: {
+                        imm_t off = slice(c, 12, 13) << 8 | slice(c, 10, 12) << 3 | slice(c, 5, 7) << 6 | slice(c, 3, 5) << 1 | slice(c, 2, 3) << 5;
+                        return enc_B(sext(off, 9), rs1p, f3 - 0x6);
+                    }
+                }
+                return 0;
+            case 2:
+                switch(f3) {
+                    case 0x0: return enc_I(imm & 31, rd, 1, rd, 0x13);
+                    case 0x2:
+                        imm = slice(c, 12, 13) << 5 | slice(c, 4, 7) << 2 | slice(c, 2, 4) << 6;
+                        return rd? enc_I(imm, 2, 2, rd, 0x03): 0;
+                    case 0x3:
+                        imm = slice(c, 12, 13) << 5 | slice(c, 4, 7) << 2 | slice(c, 2, 4) << 6;
+                        return enc_I(imm, 2, 2, rd, 0x07);
+                    case 0x4:
+                        if(!slice(c, 12, 13)) {
+                            if(!rs2) return rd? enc_I(0, rd, 0, 0, 0x67): 0;
+                            return enc_R(0, rs2, 0, 0, rd, 0x33);
+                        }
+                        if(!rs2) return rd? enc_I(0, rd, 0, 1, 0x67): 0x00100073;
+                        return enc_R(0, rs2, rd, 0, rd, 0x33);
+                    case 0x6: case 0x7:
+                        imm = slice(c, 9, 13) << 2 | slice(c, 7, 9) << 6;
+                        return enc_S(imm, rs2, 2, 2, f3 == 0x6? 0x23: 0x27);
+                }
+                return 0;
+        }
+        return 0;
+    }
+
     void decode(inst_t inst) {
         org = inst;
         opc = get_opcode(inst);
@@ -247,12 +471,12 @@ public:
                         imm = get_imm_I(inst);
                         break;
                     case 0x2: 
-                        opt = SLTI, type = 'S';
-                        imm = get_imm_S(inst);
+                        opt = SLTI, type = 'I';
+                        imm = get_imm_I(inst);
                         break;
                     case 0x3:
-                        opt = SLTIU, type = 'S';
-                        imm = get_imm_S(inst);
+                        opt = SLTIU, type = 'I';
+                        imm = get_imm_I(inst);
                         break;
                     case 0x4:
                         opt = XORI, type = 'I';
@@ -280,6 +504,20 @@ public:
                 rs1 = get_rs1(inst);
                 rs2 = get_rs2(inst);
                 funct3 = get_funct3(inst);
+                if(get_funct7(inst) == 0x01) {
+                    funct7 = 0x01;
+                    switch(funct3) {
+                        case 0x0: opt = MUL; break;
+                        case 0x1: opt = MULH; break;
+                        case 0x2: opt = MULHSU; break;
+                        case 0x3: opt = MULHU; break;
+                        case 0x4: opt = DIV; break;
+                        case 0x5: opt = DIVU; break;
+                        case 0x6: opt = REM; break;
+                        case 0x7: opt = REMU; break;
+                    }
+                    break;
+                }
                 switch(funct3) {
                     case 0x0:
                         funct7 = get_funct7(inst);
@@ -297,12 +535,211 @@ public:
                     case 0x7: opt = AND; break;
                 }
                 break;
+            case 0x2f:
+                type = 'R';
+                rd = get_rd(inst);
+                rs1 = get_rs1(inst);
+                rs2 = get_rs2(inst);
+                funct3 = get_funct3(inst);
+                funct7 = get_funct7(inst);
+                switch(funct7 >> 2) {
+                    case 0x02: opt = LR_W; break;
+                    case 0x03: opt = SC_W; break;
+                    case 0x01: opt = AMOSWAP_W; break;
+                    case 0x00: opt = AMOADD_W; break;
+                    case 0x04: opt = AMOXOR_W; break;
+                    case 0x0c: opt = AMOAND_W; break;
+                    case 0x08: opt = AMOOR_W; break;
+                    case 0x10: opt = AMOMIN_W; break;
+                    case 0x14: opt = AMOMAX_W; break;
+                    case 0x18: opt = AMOMINU_W; break;
+                    case 0x1c: opt = AMOMAXU_W; break;
+                    default: opt = NONE, type = 'N'; break;
+                }
+                if(funct3 != 0x2) opt = NONE, type = 'N';
+                break;
+            case 0x0f:
+                opt = FENCE, type = 'N';
+                break;
+            case 0x73:
+                type = 'I';
+                rd = get_rd(inst);
+                rs1 = get_rs1(inst);
+                imm = slice(inst, 20, 32);
+                funct3 = get_funct3(inst);
+                switch(funct3) {
+                    case 0x0:
+                        opt = inst == 0x00000073? ECALL: NONE, type = 'N';
+                        break;
+                    case 0x1: opt = CSRRW; break;
+                    case 0x2: opt = CSRRS; break;
+                    case 0x3: opt = CSRRC; break;
+                    case 0x5: opt = CSRRWI; break;
+                    case 0x6: opt = CSRRSI; break;
+                    case 0x7: opt = CSRRCI; break;
+                    default: opt = NONE, type = 'N'; break;
+                }
+                break;
+            case 0x07:
+                if(get_funct3(inst) != 0x2) {
+                    decode_vector_mem(inst);
+                    break;
+                }
+                opt = FLW, type = 'I';
+                rd = get_rd(inst) + FREG;
+                rs1 = get_rs1(inst);
+                imm = get_imm_I(inst);
+                funct3 = 0x2;
+                break;
+            case 0x27:
+                if(get_funct3(inst) != 0x2) {
+                    decode_vector_mem(inst);
+                    break;
+                }
+                opt = FSW, type = 'S';
+                rs1 = get_rs1(inst);
+                rs2 = get_rs2(inst) + FREG;
+                imm = get_imm_S(inst);
+                funct3 = 0x2;
+                break;
+            case 0x57:
+                decode_vector(inst);
+                break;
+            case 0x43: case 0x47: case 0x4b: case 0x4f:
+                type = 'R';
+                rd = get_rd(inst) + FREG;
+                rs1 = get_rs1(inst) + FREG;
+                rs2 = get_rs2(inst) + FREG;
+                rs3 = slice(inst, 27, 32) + FREG;
+                funct3 = get_funct3(inst);
+                opt = RV32I_Opt(FMADD_S + (opc >> 2 & 3));
+                if(slice(inst, 25, 27) || !valid_rm(funct3)) opt = NONE, type = 'N';
+                break;
+            case 0x53:
+                decode_fp(inst);
+                break;
             default:
                 opt = NONE, type = 'N';
                 break;
         }
     }
 
+private:
+    static bool valid_rm(func_t rm) {return rm != 0x5 && rm != 0x6; }
+
+    // OP-FP in single precision; a source the operation does not have is x0
+    void decode_fp(inst_t inst) {
+        type = 'R';
+        rd = get_rd(inst) + FREG;
+        rs1 = get_rs1(inst) + FREG;
+        rs2 = get_rs2(inst) + FREG;
+        rs3 = 0;
+        funct3 = get_funct3(inst);
+        funct7 = get_funct7(inst);
+        rid_t sel = get_rs2(inst);
+        opt = NONE;
+        switch(funct7) {
+            case 0x00: opt = FADD_S; break;
+            case 0x04: opt = FSUB_S; break;
+            case 0x08: opt = FMUL_S; break;
+            case 0x0c: opt = FDIV_S; break;
+            case 0x2c: opt = sel? NONE: FSQRT_S, rs2 = 0; break;
+            case 0x10: opt = funct3 < 0x3? RV32I_Opt(FSGNJ_S + funct3): NONE; break;
+            case 0x14: opt = funct3 < 0x2? RV32I_Opt(FMIN_S + funct3): NONE; break;
+            case 0x50:
+                // fle, flt, feq in funct3 order
+                opt = funct3 < 0x3? RV32I_Opt(FLE_S - funct3): NONE;
+                rd -= FREG;
+                break;
+            case 0x60:
+                opt = sel < 0x2? RV32I_Opt(FCVT_W_S + sel): NONE;
+                rd -= FREG, rs2 = 0;
+                break;
+            case 0x70:
+                opt = sel? NONE: funct3 == 0x0? FMV_X_W: funct3 == 0x1? FCLASS_S: NONE;
+                rd -= FREG, rs2 = 0;
+                break;
+            case 0x68:
+                opt = sel < 0x2? RV32I_Opt(FCVT_S_W + sel): NONE;
+                rs1 -= FREG, rs2 = 0;
+                break;
+            case 0x78:
+                opt = sel || funct3? NONE: FMV_W_X;
+                rs1 -= FREG, rs2 = 0;
+                break;
+        }
+        // the rest carry a rounding mode in funct3
+        bool rounds = funct7 < 0x10 || funct7 == 0x2c || funct7 == 0x60 || funct7 == 0x68;
+        if(rounds && !valid_rm(funct3)) opt = NONE;
+        if(opt == NONE) type = 'N';
+    }
+
+    // unmasked unit-stride and strided vector accesses of one field
+    void decode_vector_mem(inst_t inst) {
+        type = 'V';
+        rd = get_rd(inst);
+        rs1 = get_rs1(inst);
+        rs2 = get_rs2(inst);
+        funct3 = get_funct3(inst);
+        funct7 = get_funct7(inst);
+        bool load = opc == 0x07;
+        switch(slice(inst, 26, 28)) {
+            case 0x0: opt = rs2? NONE: load? VLE: VSE; break;
+            case 0x2: opt = load? VLSE: VSSE; break;
+            default: opt = NONE; break;
+        }
+        if(!vector_eew(funct3) || slice(inst, 28, 32) || !slice(inst, 25, 26)) opt = NONE;
+        if(opt == NONE) type = 'N';
+    }
+
+    // OP-V: vset{i}vl{i}, and unmasked integer arithmetic in the .vv, .vx and .vi forms
+    void decode_vector(inst_t inst) {
+        type = 'V';
+        rd = get_rd(inst);
+        rs1 = get_rs1(inst);
+        rs2 = get_rs2(inst);
+        funct3 = get_funct3(inst);
+        funct7 = get_funct7(inst);
+        opt = NONE;
+        if(funct3 == 0x7) {
+            if(!slice(inst, 31, 32)) opt = VSETVLI, imm = slice(inst, 20, 31);
+            else if(slice(inst, 30, 32) == 0x3) opt = VSETIVLI, imm = slice(inst, 20, 30);
+            else if(!slice(inst, 25, 31)) opt = VSETVL;
+            return ;
+        }
+        func_t funct6 = slice(inst, 26, 32);
+        bool vm = slice(inst, 25, 26);
+        imm = sext(rs1, 5);
+        switch(funct3) {
+            case 0x0: case 0x3: case 0x4:
+                switch(funct6) {
+                    case 0x00: opt = VADD; break;
+                    case 0x02: opt = funct3 == 0x3? NONE: VSUB; break;
+                    case 0x03: opt = funct3 == 0x0? NONE: VRSUB; break;
+                    case 0x04: opt = funct3 == 0x3? NONE: VMINU; break;
+                    case 0x05: opt = funct3 == 0x3? NONE: VMIN; break;
+                    case 0x06: opt = funct3 == 0x3? NONE: VMAXU; break;
+                    case 0x07: opt = funct3 == 0x3? NONE: VMAX; break;
+                    case 0x09: opt = VAND; break;
+                    case 0x0a: opt = VOR; break;
+                    case 0x0b: opt = VXOR; break;
+                    case 0x17: opt = rs2? NONE: VMV; break;
+                }
+                break;
+            case 0x2:
+                if(funct6 < 0x08) opt = RV32I_Opt(VREDSUM + funct6);
+                else if(funct6 == 0x10) opt = rs1? NONE: VMV_X_S;
+                else if(funct6 == 0x25) opt = VMUL;
+                break;
+            case 0x6:
+                if(funct6 == 0x10) opt = rs2? NONE: VMV_S_X;
+                else if(funct6 == 0x25) opt = VMUL;
+                break;
+        }
+        if(!vm) opt = NONE;
+        if(opt == NONE) type = 'N';
+    }
+
 };
 
 }
@@ -0,0 +1,165 @@
+#ifndef __RISCV_SIMULATOR_KANATA_H__
+#define __RISCV_SIMULATOR_KANATA_H__
+
+#include "utils.h"
+#include <cstdio>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace riscv {
+
+// file output on a background thread: text is appended to an in-memory chunk, and full
+// chunks are handed over under a lock, so the producer never waits for the disk
+class Async_writer {
+private:
+    const static size_t CHUNK = 1 << 20;
+
+    FILE *fp;
+    std::string buf;
+    std::deque<std::string> full;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool closing;
+    std::thread worker;
+
+    void drain() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while(true) {
+            cv.wait(lock, [&]() {return closing || !full.empty(); });
+            if(full.empty()) return ;
+            std::string chunk = std::move(full.front());
+            full.pop_front();
+            lock.unlock();
+            fwrite(chunk.data(), 1, chunk.size(), fp);
+            lock.lock();
+        }
+    }
+    void hand_over() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            full.push_back(std::move(buf));
+        }
+        cv.notify_one();
+        buf.clear();
+        buf.reserve(CHUNK + 256);
+    }
+
+public:
+    Async_writer(): fp(nullptr), closing(0) {}
+    ~Async_writer() {close(); }
+
+    bool open(const std::string &path) {
+        fp = fopen(path.c_str(), "w");
+        if(!fp) return 0;
+        closing = 0;
+        buf.reserve(CHUNK + 256);
+        worker = std::thread([this]() {drain(); });
+        return 1;
+    }
+    bool opened() {return fp != nullptr; }
+
+    void write(const char *s, size_t len) {
+        buf.append(s, len);
+        if(buf.size() >= CHUNK) hand_over();
+    }
+
+    void close() {
+        if(!fp) return ;
+        if(!buf.empty()) hand_over();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            closing = 1;
+        }
+        cv.notify_one();
+        worker.join();
+        fclose(fp);
+        fp = nullptr;
+    }
+};
+
+// per-instruction pipeline log in the Kanata 0004 format read by the Konata viewer:
+// every fetched instruction gets an id, stages start on lane 0 and end where the next one
+// starts, and each instruction ends retired or flushed
+class Kanata_writer {
+private:
+    Async_writer out;
+    long long cur;          // cycle of the last command
+    bool started;
+    long long next_id, retired;
+    // the command being built, formatted by hand since this runs several times per instruction
+    char line[160];
+    int len;
+
+    Kanata_writer& str(const char *s) {
+        while(*s && len < 150) line[len++] = *s++;
+        return *this;
+    }
+    Kanata_writer& num(long long x) {
+        char tmp[24];
+        int n = 0;
+        do tmp[n++] = '0' + x % 10, x /= 10; while(x);
+        while(n) line[len++] = tmp[--n];
+        return *this;
+    }
+    Kanata_writer& hex(word x) {
+        for(int i = 7; i >= 0; --i) line[len++] = "0123456789abcdef"[x >> 4 * i & 15];
+        return *this;
+    }
+    Kanata_writer& tab() {line[len++] = '\t'; return *this; }
+    void end() {
+        line[len++] = '\n';
+        out.write(line, len);
+        len = 0;
+    }
+
+    void at(long long cycle) {
+        if(!started) str("C=").tab().num(cycle).end(), started = 1;
+        else if(cycle != cur) str("C").tab().num(cycle - cur).end();
+        cur = cycle;
+    }
+
+public:
+    Kanata_writer(): cur(0), started(0), next_id(0), retired(0), len(0) {}
+
+    bool open(const std::string &path) {
+        if(!out.open(path)) return 0;
+        out.write("Kanata\t0004\n", 12);
+        return 1;
+    }
+    bool opened() {return out.opened(); }
+
+    // a new instruction entering fetch, returns its id
+    long long fetch(long long cycle, int thread, addr_t pc, inst_t inst, const char *name) {
+        at(cycle);
+        long long id = next_id++;
+        str("I").tab().num(id).tab().num(id).tab().num(thread).end();
+        str("L").tab().num(id).tab().str("0").tab().hex(pc).str(": ").hex(inst).str(" ").str(name).end();
+        str("S").tab().num(id).tab().str("0").tab().str("F").end();
+        return id;
+    }
+    void stage(long long cycle, long long id, const char *name) {
+        at(cycle);
+        str("S").tab().num(id).tab().str("0").tab().str(name).end();
+    }
+    // extra text shown when hovering over the instruction
+    void note(long long id, const char *text) {
+        str("L").tab().num(id).tab().str("1").tab().str(text).end();
+    }
+    void retire(long long cycle, long long id) {
+        at(cycle);
+        str("R").tab().num(id).tab().num(retired++).tab().str("0").end();
+    }
+    void flush(long long cycle, long long id) {
+        at(cycle);
+        str("R").tab().num(id).tab().str("0").tab().str("1").end();
+    }
+
+    void close() {out.close(); }
+};
+
+}
+
+#endif
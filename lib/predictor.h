@@ -0,0 +1,435 @@
+#ifndef __RISCV_SIMULATOR_PREDICTOR_H__
+#define __RISCV_SIMULATOR_PREDICTOR_H__
+
+#include "utils.h"
+#include <vector>
+#include <string>
+#include <memory>
+#include <sstream>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+namespace riscv {
+
+// n-bit saturating counters packed into 64-bit words
+template <int BITS>
+class Packed_table {
+private:
+    const static int PER_WORD = 64 / BITS;
+    const static u_int64_t MASK = (1ull << BITS) - 1;
+    std::vector<u_int64_t> data;
+
+public:
+    const static int MAX = (1 << BITS) - 1;
+
+    void resize(size_t len, int init = 0) {
+        u_int64_t fill = 0;
+        for(int i = 0; i < PER_WORD; ++i) fill |= (init & MASK) << (i * BITS);
+        data.assign((len + PER_WORD - 1) / PER_WORD, fill);
+    }
+
+    int get(size_t idx) const {
+        return data[idx / PER_WORD] >> (idx % PER_WORD * BITS) & MASK;
+    }
+    void set(size_t idx, int val) {
+        int sh = idx % PER_WORD * BITS;
+        u_int64_t &w = data[idx / PER_WORD];
+        w = (w & ~(MASK << sh)) | (u_int64_t(val) & MASK) << sh;
+    }
+    void inc(size_t idx) {
+        int val = get(idx);
+        if(val < MAX) set(idx, val + 1);
+    }
+    void dec(size_t idx) {
+        int val = get(idx);
+        if(val > 0) set(idx, val - 1);
+    }
+    void train(size_t idx, bool up) {
+        if(up) inc(idx); else dec(idx);
+    }
+    bool taken(size_t idx) const {
+        return get(idx) > (MAX >> 1);
+    }
+};
+
+struct Predictor_config {
+    std::string type;
+    int index_bits;     // log2 of the number of (per-table) entries
+    int history_bits;   // global history length
+    int local_bits;     // local history length
+    int tables;         // number of tagged tables (tage)
+    int tag_bits;       // tag width (tage)
+
+    Predictor_config(): type("tournament"), index_bits(0), history_bits(0),
+        local_bits(0), tables(0), tag_bits(0) {}
+
+    // parse "name[:key=val,key=val...]", e.g. "gshare:index=14,history=14"
+    static bool parse(const std::string &spec, Predictor_config &cfg) {
+        cfg = Predictor_config();
+        auto colon = spec.find(':');
+        cfg.type = spec.substr(0, colon);
+        if(cfg.type != "bimodal" && cfg.type != "gshare" && cfg.type != "tournament"
+            && cfg.type != "tage" && cfg.type != "perceptron") return 0;
+        if(colon == std::string::npos) return 1;
+        std::stringstream ss(spec.substr(colon + 1));
+        std::string item;
+        while(std::getline(ss, item, ',')) {
+            auto eq = item.find('=');
+            if(eq == std::string::npos) return 0;
+            auto key = item.substr(0, eq);
+            int val = std::atoi(item.substr(eq + 1).c_str());
+            if(val <= 0) return 0;
+            if(key == "index") cfg.index_bits = val;
+            else if(key == "history") cfg.history_bits = val;
+            else if(key == "local") cfg.local_bits = val;
+            else if(key == "tables") cfg.tables = val;
+            else if(key == "tag") cfg.tag_bits = val;
+            else return 0;
+        }
+        Predictor_config full = cfg;
+        full.fill_defaults();
+        return full.valid();
+    }
+
+    // the per-type defaults of the keys left out
+    void fill_defaults() {
+        auto def = [](int &val, int def_val) {if(!val) val = def_val; };
+        if(type == "bimodal") def(index_bits, 12);
+        else if(type == "gshare") def(index_bits, 12), def(history_bits, 12);
+        else if(type == "tournament") def(index_bits, 12), def(history_bits, 3), def(local_bits, 2);
+        else if(type == "tage") def(index_bits, 10), def(history_bits, 64), def(tables, 4), def(tag_bits, 9);
+        else if(type == "perceptron") def(index_bits, 8), def(history_bits, 24);
+    }
+
+    // sizes the tables can be built with: histories fit their 32-bit registers (64 bits for the
+    // perceptron, the 2047-outcome buffer for tage) and the tables stay within a few hundred MiB
+    bool valid() const {
+        auto in = [](int val, int lo, int hi) {return val >= lo && val <= hi; };
+        if(type == "bimodal") return in(index_bits, 1, 24);
+        if(type == "gshare") return in(index_bits, 1, 24) && in(history_bits, 1, 31);
+        if(type == "tournament") {
+            return in(index_bits, 1, 24) && in(history_bits, 1, 31) && in(local_bits, 1, 31)
+                && index_bits + history_bits <= 24 && index_bits + local_bits <= 24;
+        }
+        if(type == "tage") {
+            // the second tag hash folds into tag - 1 bits, and tags are stored in 16 bits
+            return in(index_bits, 1, 20) && in(history_bits, 1, 2047) && in(tables, 1, 16) && in(tag_bits, 2, 16);
+        }
+        if(type == "perceptron") return in(index_bits, 1, 16) && in(history_bits, 1, 64);
+        return 0;
+    }
+
+    std::string to_string() const {
+        std::stringstream ss;
+        ss << type << ":index=" << index_bits;
+        if(type != "bimodal") ss << ",history=" << history_bits;
+        if(type == "tournament") ss << ",local=" << local_bits;
+        if(type == "tage") ss << ",tables=" << tables << ",tag=" << tag_bits;
+        return ss.str();
+    }
+};
+
+class Predictor {
+public:
+    virtual ~Predictor() {}
+    virtual bool predict(addr_t pc) = 0;
+    virtual void update(addr_t pc, bool jump) = 0;
+
+protected:
+    static word hash(addr_t pc, int bits) {
+        return ((pc >> 12) ^ (pc >> 2)) & ((1u << bits) - 1);
+    }
+};
+
+class Bimodal: public Predictor {
+private:
+    int bits;
+    Packed_table<2> PHT;
+
+public:
+    Bimodal(int index_bits): bits(index_bits) {
+        PHT.resize(1u << bits);
+    }
+    bool predict(addr_t pc) override {
+        return PHT.taken(hash(pc, bits));
+    }
+    void update(addr_t pc, bool jump) override {
+        PHT.train(hash(pc, bits), jump);
+    }
+};
+
+class Gshare: public Predictor {
+private:
+    int bits, hist_len;
+    word GHR;
+    Packed_table<2> PHT;
+
+    word index(addr_t pc) {
+        return (hash(pc, bits) ^ GHR) & ((1u << bits) - 1);
+    }
+
+public:
+    Gshare(int index_bits, int history_bits): bits(index_bits), hist_len(history_bits), GHR(0) {
+        PHT.resize(1u << bits);
+    }
+    bool predict(addr_t pc) override {
+        return PHT.taken(index(pc));
+    }
+    void update(addr_t pc, bool jump) override {
+        PHT.train(index(pc), jump);
+        GHR = ((GHR << 1) | jump) & ((1u << hist_len) - 1);
+    }
+};
+
+// global/local competitive predictor; all histories of one branch share a cache line
+class Tournament: public Predictor {
+private:
+    int bits, hist_len, local_len;
+    word GHR;
+    std::vector<word> BHT;
+    Packed_table<2> GPHT, BPHT, CPHT;
+
+    word gidx(word key) {return key << hist_len | GHR; }
+    word lidx(word key) {return key << local_len | BHT[key]; }
+
+public:
+    Tournament(int index_bits, int history_bits, int local_bits):
+        bits(index_bits), hist_len(history_bits), local_len(local_bits), GHR(0) {
+        BHT.assign(1u << bits, 0);
+        GPHT.resize(1u << (bits + hist_len));
+        CPHT.resize(1u << (bits + hist_len));
+        BPHT.resize(1u << (bits + local_len));
+    }
+
+    bool predict(addr_t pc) override {
+        word key = hash(pc, bits);
+        if(CPHT.taken(gidx(key))) return GPHT.taken(gidx(key));
+        else return BPHT.taken(lidx(key));
+    }
+
+    void update(addr_t pc, bool jump) override {
+        word key = hash(pc, bits);
+        word g = gidx(key), l = lidx(key);
+        bool p1 = GPHT.taken(g) == jump;
+        bool p2 = BPHT.taken(l) == jump;
+        if(p1 != p2) CPHT.train(g, p1);
+        GPHT.train(g, jump), BPHT.train(l, jump);
+        GHR = ((GHR << 1) | jump) & ((1u << hist_len) - 1);
+        BHT[key] = ((BHT[key] << 1) | jump) & ((1u << local_len) - 1);
+    }
+};
+
+// the latest `org_len` outcomes folded incrementally into `len` bits
+struct Folded_history {
+    int org_len, len;
+    word comp;
+
+    void init(int org, int fold) {org_len = org, len = fold, comp = 0; }
+    void update(const std::vector<byte> &hist, int head) {
+        // hist[head] is the newest outcome, hist[head + org_len] the one leaving the window
+        comp = (comp << 1) | hist[head];
+        comp ^= word(hist[head + org_len]) << (org_len % len);
+        comp ^= comp >> len;
+        comp &= (1u << len) - 1;
+    }
+};
+
+class Tage: public Predictor {
+private:
+    struct Entry {
+        u_int16_t tag;
+        int8_t ctr;     // 3-bit signed
+        byte u;         // 2-bit usefulness
+    };
+
+    const static int HIST_BUF = 1 << 12;
+
+    int bits, num, tag_len;
+    Packed_table<2> base;
+    std::vector<Entry> table;   // num tables of (1 << bits) entries, stored back to back
+    std::vector<int> hist_len;
+    std::vector<Folded_history> fidx, ftag1, ftag2;
+    std::vector<byte> hist;     // outcome history, newest at `head`
+    int head;
+    word path;
+    int tick;
+    std::vector<word> idx, tag;
+
+    void compute(addr_t pc) {
+        for(int i = 0; i < num; ++i) {
+            idx[i] = (hash(pc, bits) ^ (pc >> (bits + 2)) ^ fidx[i].comp ^ (path & ((1u << bits) - 1)))
+                & ((1u << bits) - 1);
+            tag[i] = (hash(pc, tag_len) ^ ftag1[i].comp ^ (ftag2[i].comp << 1)) & ((1u << tag_len) - 1);
+        }
+    }
+    Entry& entry(int t) {return table[t << bits | idx[t]]; }
+
+    // index of the providing table and of the alternate one, -1 for the base predictor
+    void lookup(int &provider, int &alt) {
+        provider = alt = -1;
+        for(int i = num - 1; i >= 0; --i) {
+            if(entry(i).tag == tag[i]) {
+                if(provider < 0) provider = i;
+                else {alt = i; break; }
+            }
+        }
+    }
+
+public:
+    Tage(int index_bits, int history_bits, int tables, int tag_bits):
+        bits(index_bits), num(tables), tag_len(tag_bits), head(HIST_BUF / 2), path(0), tick(0) {
+        base.resize(1u << (bits + 2), 2);
+        table.assign(size_t(num) << bits, Entry{0, 0, 0});
+        hist.assign(HIST_BUF, 0);
+        idx.resize(num), tag.resize(num);
+        // geometric history lengths from 4 up to history_bits
+        hist_len.resize(num);
+        fidx.resize(num), ftag1.resize(num), ftag2.resize(num);
+        for(int i = 0; i < num; ++i) {
+            double ratio = num > 1? double(i) / (num - 1): 1.0;
+            int len = int(4 * std::pow(double(history_bits) / 4, ratio) + 0.5);
+            hist_len[i] = std::min(len, HIST_BUF / 2 - 1);
+            fidx[i].init(hist_len[i], bits);
+            ftag1[i].init(hist_len[i], tag_len);
+            ftag2[i].init(hist_len[i], tag_len - 1);
+        }
+    }
+
+    bool predict(addr_t pc) override {
+        compute(pc);
+        int provider, alt;
+        lookup(provider, alt);
+        if(provider < 0) return base.taken(hash(pc, bits + 2));
+        auto &e = entry(provider);
+        // newly allocated weak entries defer to the alternate prediction
+        if((e.ctr == 0 || e.ctr == -1) && e.u == 0) {
+            if(alt < 0) return base.taken(hash(pc, bits + 2));
+            return entry(alt).ctr >= 0;
+        }
+        return e.ctr >= 0;
+    }
+
+    void update(addr_t pc, bool jump) override {
+        compute(pc);
+        int provider, alt;
+        lookup(provider, alt);
+        bool base_pred = base.taken(hash(pc, bits + 2));
+        bool alt_pred = alt < 0? base_pred: entry(alt).ctr >= 0;
+        bool pred = provider < 0? base_pred: entry(provider).ctr >= 0;
+
+        if(provider >= 0) {
+            auto &e = entry(provider);
+            if(pred != alt_pred) {
+                if(pred == jump) {if(e.u < 3) e.u++; }
+                else if(e.u > 0) e.u--;
+            }
+            if(jump) {if(e.ctr < 3) e.ctr++; }
+            else if(e.ctr > -4) e.ctr--;
+            if(alt < 0) base.train(hash(pc, bits + 2), jump);
+        }
+        else base.train(hash(pc, bits + 2), jump);
+
+        // allocate one entry in a longer table on a misprediction
+        if(pred != jump && provider < num - 1) {
+            bool done = 0;
+            for(int i = provider + 1; i < num; ++i) {
+                auto &e = entry(i);
+                if(e.u == 0) {
+                    e.tag = tag[i], e.ctr = jump? 0: -1;
+                    done = 1; break;
+                }
+            }
+            if(!done) {
+                for(int i = provider + 1; i < num; ++i) {
+                    if(entry(i).u > 0) entry(i).u--;
+                }
+            }
+        }
+        // graceful aging of usefulness bits
+        if(++tick == (1 << 18)) {
+            tick = 0;
+            for(auto &e: table) e.u >>= 1;
+        }
+
+        // shift history
+        if(head == 0) {
+            std::copy(hist.begin(), hist.begin() + HIST_BUF / 2, hist.begin() + HIST_BUF / 2);
+            head = HIST_BUF / 2;
+        }
+        hist[--head] = jump;
+        for(int i = 0; i < num; ++i) {
+            fidx[i].update(hist, head);
+            ftag1[i].update(hist, head);
+            ftag2[i].update(hist, head);
+        }
+        path = (path << 1) | ((pc >> 2) & 1);
+    }
+};
+
+class Perceptron: public Predictor {
+private:
+    int bits, hist_len, threshold;
+    std::vector<int8_t> weight;     // one row of (hist_len + 1) weights per perceptron
+    u_int64_t GHR;
+
+    int output(addr_t pc) {
+        const int8_t *w = &weight[size_t(hash(pc, bits)) * (hist_len + 1)];
+        int y = w[0];
+        for(int i = 0; i < hist_len; ++i) {
+            y += (GHR >> i & 1)? w[i + 1]: -w[i + 1];
+        }
+        return y;
+    }
+    static void train(int8_t &w, bool up) {
+        if(up) {if(w < 127) w++; }
+        else if(w > -128) w--;
+    }
+
+public:
+    Perceptron(int index_bits, int history_bits): bits(index_bits), GHR(0) {
+        hist_len = std::min(history_bits, 64);
+        threshold = int(1.93 * hist_len + 14);
+        weight.assign(size_t(hist_len + 1) << bits, 0);
+    }
+
+    bool predict(addr_t pc) override {
+        return output(pc) >= 0;
+    }
+
+    void update(addr_t pc, bool jump) override {
+        int y = output(pc);
+        if((y >= 0) != jump || std::abs(y) <= threshold) {
+            int8_t *w = &weight[size_t(hash(pc, bits)) * (hist_len + 1)];
+            train(w[0], jump);
+            for(int i = 0; i < hist_len; ++i) train(w[i + 1], (GHR >> i & 1) == jump);
+        }
+        GHR = (GHR << 1) | jump;
+        if(hist_len < 64) GHR &= (1ull << hist_len) - 1;
+    }
+};
+
+// fills in the per-type defaults and builds the predictor
+inline std::unique_ptr<Predictor> make_predictor(Predictor_config &cfg) {
+    cfg.fill_defaults();
+    if(cfg.type == "bimodal") {
+        return std::unique_ptr<Predictor>(new Bimodal(cfg.index_bits));
+    }
+    if(cfg.type == "gshare") {
+        return std::unique_ptr<Predictor>(new Gshare(cfg.index_bits, cfg.history_bits));
+    }
+    if(cfg.type == "tournament") {
+        return std::unique_ptr<Predictor>(new Tournament(cfg.index_bits, cfg.history_bits, cfg.local_bits));
+    }
+    if(cfg.type == "tage") {
+        return std::unique_ptr<Predictor>(new Tage(cfg.index_bits, cfg.history_bits, cfg.tables, cfg.tag_bits));
+    }
+    if(cfg.type == "perceptron") {
+        return std::unique_ptr<Predictor>(new Perceptron(cfg.index_bits, cfg.history_bits));
+    }
+    return nullptr;
+}
+
+}
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef __RISCV_SIMULATOR_PREFETCHER_H__
+#define __RISCV_SIMULATOR_PREFETCHER_H__
+
+#include "utils.h"
+#include "cache.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+
+namespace riscv {
+
+struct Prefetch_config {
+    int degree;     // lines fetched per trigger
+    int distance;   // strides (at least one line each) between the load and the first line fetched
+    int entries;    // lines the prefetch buffer holds
+    int latency;    // cycles of a read served by the buffer
+    int table;      // entries of the pc-indexed stride table
+
+    Prefetch_config(): degree(2), distance(4), entries(16), latency(1), table(256) {}
+
+    // parse "key=val,..." with keys degree, distance, entries, latency, table
+    static bool parse(const std::string &spec, Prefetch_config &cfg) {
+        std::stringstream ss(spec);
+        std::string item;
+        while(std::getline(ss, item, ',')) {
+            auto eq = item.find('=');
+            if(eq == std::string::npos) return 0;
+            auto key = item.substr(0, eq), val = item.substr(eq + 1);
+            char *end;
+            long num = std::strtol(val.c_str(), &end, 10);
+            if(*end || num <= 0) return 0;
+            if(key == "degree") cfg.degree = num;
+            else if(key == "distance") cfg.distance = num;
+            else if(key == "entries") cfg.entries = num;
+            else if(key == "latency") cfg.latency = num;
+            else if(key == "table") cfg.table = num;
+            else return 0;
+        }
+        return cfg.degree <= cfg.entries;
+    }
+};
+
+// pc-indexed stride prefetcher in front of a memory level: executed loads train a reference
+// prediction table, and once a load repeats its stride the lines `distance` strides ahead are
+// fetched into a small fully-associative buffer; a read finding its line there completes in
+// `latency` cycles, or waits for the fill when it is still on the way
+class Stride_prefetcher: public Memory_level {
+private:
+    struct Stream {
+        addr_t pc, last;
+        int stride, conf;
+    };
+    struct Entry {
+        bool valid;
+        addr_t line;
+        int lower;          // ticket of the fill, -1 once the line arrived
+        bool used;          // a demand read hit it
+        bool waited;        // a demand read waits for the fill, the entry must stay
+        long long stamp;
+    };
+    const static int CONF_MIN = 2;
+
+    Prefetch_config cfg;
+    Memory_level *next;
+    int line_bits;
+    std::vector<Stream> table;
+    std::vector<Entry> buf;
+    std::vector<int> lower;     // per ticket: access passed on to the next level, -1 when served here
+    Ticket_pool pool;
+    long long now;
+
+    long long issued, dropped, useful, hits, late, misses;
+
+    Entry* find(addr_t line) {
+        for(auto &e: buf) {
+            if(e.valid && e.line == line) return &e;
+        }
+        return nullptr;
+    }
+
+    int track(int ticket, int low) {
+        if(ticket >= int(lower.size())) lower.resize(ticket + 1);
+        lower[ticket] = low;
+        return ticket;
+    }
+
+    void prefetch(addr_t line) {
+        if(find(line)) return ;
+        // the victim is a free entry, else a line a demand read already took (the level above
+        // holds it now), else the oldest prefetch not used yet
+        auto older = [](const Entry &a, const Entry &b) {
+            return a.used != b.used? a.used: a.stamp < b.stamp;
+        };
+        Entry *v = nullptr;
+        for(auto &e: buf) {
+            if(e.waited) continue;
+            if(!e.valid) {v = &e; break; }
+            if(!v || older(e, *v)) v = &e;
+        }
+        int ticket = v? next->request(line << line_bits, 0): -1;
+        if(ticket < 0) {
+            dropped++;
+            return ;
+        }
+        if(v->valid && v->lower >= 0) next->release(v->lower);
+        *v = Entry{1, line, ticket, 0, 0, now};
+        issued++;
+    }
+
+public:
+    Stride_prefetcher(const Prefetch_config &config, Memory_level *lower_level, int line):
+        cfg(config), next(lower_level), now(0),
+        issued(0), dropped(0), useful(0), hits(0), late(0), misses(0) {
+        line_bits = 0;
+        while((1 << line_bits) < line) line_bits++;
+        table.assign(cfg.table, Stream{0, 0, 0, 0});
+        buf.assign(cfg.entries, Entry{0, 0, -1, 0, 0, 0});
+    }
+
+    // a load at `pc` executed with address `addr`
+    void observe(addr_t pc, addr_t addr) {
+        auto &s = table[(pc >> 1) % table.size()];
+        if(s.pc != pc) {
+            s = Stream{pc, addr, 0, 0};
+            return ;
+        }
+        int stride = addr - s.last;
+        if(stride && stride == s.stride) {
+            if(s.conf < 3) s.conf++;
+        }
+        else s.conf = 0;
+        s.stride = stride, s.last = addr;
+        if(s.conf < CONF_MIN) return ;
+        int size = 1 << line_bits;
+        int step = std::abs(stride) >= size? stride: stride < 0? -size: size;
+        for(int i = 0; i < cfg.degree; ++i) prefetch((addr + step * (cfg.distance + i)) >> line_bits);
+    }
+
+    int request(addr_t addr, bool write) override {
+        Entry *e = write? nullptr: find(addr >> line_bits);
+        if(e) {
+            hits++;
+            if(!e->used) useful++, e->used = 1;
+            e->stamp = now;
+            if(e->lower < 0) return track(pool.allocate(now + cfg.latency), -1);
+            late++, e->waited = 1;
+            return track(pool.allocate(-1, e - &buf[0]), -1);
+        }
+        int ticket = next->request(addr, write);
+        if(ticket < 0) return -1;
+        if(!write) misses++;
+        return track(pool.allocate(-1), ticket);
+    }
+
+    bool ready(int ticket) override {
+        return lower[ticket] >= 0? next->ready(lower[ticket]): pool.done(ticket, now);
+    }
+    void release(int ticket) override {
+        if(lower[ticket] >= 0) next->release(lower[ticket]);
+        pool.free(ticket);
+    }
+
+    void tick() override {
+        now++;
+        for(int i = 0; i < int(buf.size()); ++i) {
+            auto &e = buf[i];
+            if(!e.valid || e.lower < 0 || !next->ready(e.lower)) continue;
+            next->release(e.lower);
+            e.lower = -1;
+            if(e.waited) pool.wake(i, now + cfg.latency), e.waited = 0;
+        }
+    }
+
+    void report(std::ostream &os) override {
+        os << "[prefetch] degree " << cfg.degree << " distance " << cfg.distance << " issued " << issued;
+        os << " useful " << useful << " accuracy " << (issued? 1.0 * useful / issued: 0.0);
+        os << " hits " << hits << " (late " << late << ") misses " << misses;
+        os << " coverage " << (hits + misses? 1.0 * hits / (hits + misses): 0.0) << " dropped " << dropped << '\n';
+    }
+};
+
+}
+
+#endif
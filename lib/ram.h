@@ -3,43 +3,139 @@
 
 #include "utils.h"
 #include <cstring>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 namespace riscv {
 
 template <size_t MEM_SIZE>
 class RAM {
 private:
-    byte mem[MEM_SIZE];
+    alignas(4) byte mem[MEM_SIZE];
+
+    // lr.w reservations, the reserved word's address per hart or NONE; every write to a
+    // reserved word cancels the reservations on it, so sc.w fails after any intervening store.
+    // harts on other host threads access memory concurrently: bytes are read and written with
+    // relaxed atomics, and while any reservation exists, writes to a word, lr.w and sc.w on it
+    // take one of STRIPES spin locks, so an sc.w checks its reservation and stores in one step
+    const static addr_t NONE = ~0u;
+    const static int STRIPES = 64;
+    std::unique_ptr<std::atomic<addr_t>[]> reserve;
+    std::vector<word> reserve_val;  // what lr.w read, each hart's own
+    int harts;
+    std::atomic<int> reserved;      // harts holding a reservation, writes skip the locks at 0
+    std::atomic<bool> locks[STRIPES];
+
+    word* word_ptr(addr_t addr) {
+        return reinterpret_cast<word*>(mem + addr);
+    }
+
+    std::atomic<bool>& lock(addr_t addr) {
+        auto &l = locks[addr >> 2 & (STRIPES - 1)];
+        while(l.exchange(1, std::memory_order_acquire));
+        return l;
+    }
+
+    void cancel(int hart) {
+        addr_t cur = reserve[hart].load();
+        if(cur != NONE && reserve[hart].compare_exchange_strong(cur, NONE)) reserved--;
+    }
+    void touch(addr_t addr) {
+        addr &= ~3u;
+        for(int i = 0; i < harts; ++i) {
+            addr_t cur = addr;
+            if(reserve[i].compare_exchange_strong(cur, NONE)) reserved--;
+        }
+    }
+
+    byte get(addr_t addr) {
+        return __atomic_load_n(mem + addr, __ATOMIC_RELAXED);
+    }
+    void put(addr_t addr, byte data) {
+        if(!reserved.load()) {
+            __atomic_store_n(mem + addr, data, __ATOMIC_RELAXED);
+            return ;
+        }
+        auto &l = lock(addr);
+        __atomic_store_n(mem + addr, data, __ATOMIC_RELAXED);
+        touch(addr);
+        l.store(0, std::memory_order_release);
+    }
 
 public:
-    RAM() {
+    RAM(): harts(0), reserved(0) {
         memset(mem, 0, sizeof(mem));
+        for(auto &l: locks) l = 0;
+    }
+
+    void init_harts(int num) {
+        harts = num;
+        reserve.reset(new std::atomic<addr_t>[num]);
+        for(int i = 0; i < num; ++i) reserve[i] = NONE;
+        reserve_val.assign(num, 0);
     }
 
     byte read_byte(addr_t addr) {
-        return mem[addr];
+        return get(addr);
     }
     hfword read_hfword(addr_t addr) {
-        return mem[addr] | (mem[addr + 1] << 8);
+        return get(addr) | (get(addr + 1) << 8);
     }
     word read_word(addr_t addr) {
-        return mem[addr] | (mem[addr + 1] << 8) | (mem[addr + 2] << 16) | (mem[addr + 3] << 24);
+        return get(addr) | (get(addr + 1) << 8) | (get(addr + 2) << 16) | (get(addr + 3) << 24);
     }
 
     void write_byte(addr_t addr, word data) {
-        mem[addr] = data & 255;
+        put(addr, data & 255);
     }
     void write_hfword(addr_t addr, word data) {
-        mem[addr + 0] = data >> 0 & 255;
-        mem[addr + 1] = data >> 8 & 255;
+        put(addr + 0, data >> 0 & 255);
+        put(addr + 1, data >> 8 & 255);
     }
     void write_word(addr_t addr, word data) {
-        mem[addr + 0] = data >>  0 & 255;
-        mem[addr + 1] = data >>  8 & 255;
-        mem[addr + 2] = data >> 16 & 255;
-        mem[addr + 3] = data >> 24 & 255;
+        put(addr + 0, data >>  0 & 255);
+        put(addr + 1, data >>  8 & 255);
+        put(addr + 2, data >> 16 & 255);
+        put(addr + 3, data >> 24 & 255);
     }
 
+    // atomic accesses to aligned words, shared between harts running on different host threads
+    word atomic_read(addr_t addr) {
+        return __atomic_load_n(word_ptr(addr), __ATOMIC_SEQ_CST);
+    }
+    template <typename F>
+    word atomic_update(addr_t addr, F func) {
+        std::atomic<bool> *l = reserved.load()? &lock(addr): nullptr;
+        word old = __atomic_load_n(word_ptr(addr), __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(word_ptr(addr), &old, func(old), 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+        if(l) touch(addr), l->store(0, std::memory_order_release);
+        return old;
+    }
+
+    // lr.w: reserve the word, then read it
+    word load_reserved(int hart, addr_t addr) {
+        auto &l = lock(addr);
+        if(reserve[hart].exchange(addr & ~3u) == NONE) reserved++;
+        word val = reserve_val[hart] = atomic_read(addr);
+        l.store(0, std::memory_order_release);
+        return val;
+    }
+    // sc.w: stores only if no write reached the word since the hart's lr.w; the hart's
+    // reservation ends either way. a write that checked for reservations just before the lr.w
+    // took it skipped the lock, the value lr.w read catches whatever it changed
+    bool store_conditional(int hart, addr_t addr, word data) {
+        auto &l = lock(addr);
+        addr_t expect = addr & ~3u;
+        bool ok = reserve[hart].load() == expect && atomic_read(addr) == reserve_val[hart];
+        if(ok) {
+            __atomic_store_n(word_ptr(addr), data, __ATOMIC_SEQ_CST);
+            touch(addr);
+        }
+        else cancel(hart);
+        l.store(0, std::memory_order_release);
+        return ok;
+    }
 };
 
 }
@@ -20,6 +20,8 @@ public:
         this->cur_stat().flag = this->nex_stat().flag = tag;
     }
     bool pending() {return this->cur_stat().flag; }
+    // also counts a value written earlier in this cycle
+    bool taken() {return this->nex_stat().flag; }
     void pend(bool stat) {this->nex_stat().flag = stat; }
     T read() {return this->cur_stat().data; }
     void write(const T &val) {this->nex_stat().data = val; }
@@ -31,6 +33,14 @@ public:
     void flush() {
         this->nex_stat().flag = 0;
     }
+    // drop a pending value `pred` holds for, returns whether it did
+    template <typename F>
+    bool cancel_if(F pred) {
+        auto &nex = this->nex_stat();
+        if(!nex.flag || !pred(nex.data)) return 0;
+        nex.flag = 0;
+        return 1;
+    }
 
 };
 using Reg = Register<word>;
@@ -85,6 +95,148 @@ public:
 
 };
 
+// architectural registers renamed: x0-x31, then f0-f31
+const int ARCH_REGS = 64;
+
+template <size_t PHYS_NUM>
+struct Prf_stat {
+    word val[PHYS_NUM];
+    bool ready[PHYS_NUM];
+    byte map[ARCH_REGS];    // speculative rename map
+    byte arch[ARCH_REGS];   // committed rename map
+};
+
+// merged physical register file: values of both committed and in-flight results live here,
+// physical register 0 is the constant zero and doubles as the "no dependency" tag;
+// the tags handed out are offset by `base`, so register files of several threads can share a cdb
+template <size_t PHYS_NUM = 128>
+class Phys_regfile: public Sequential< Prf_stat<PHYS_NUM> > {
+private:
+    int num;
+    byte base;
+    // free list in allocation order, [retire, head) is held by uncommitted instructions
+    byte free_list[PHYS_NUM];
+    unsigned head, retire, tail;
+    // mappings (committed or in flight) per register, above 1 after move elimination
+    int refs[PHYS_NUM];
+
+    byte local(byte p) {return p? p - base: 0; }
+    byte global(byte p) {return p? p + base: 0; }
+    void free_reg(byte p) {
+        if(p && --refs[p] == 0) free_list[tail++ % PHYS_NUM] = p;
+    }
+
+public:
+    struct Checkpoint {
+        byte map[ARCH_REGS];
+        unsigned head;
+    };
+
+    void release(byte p) {free_reg(local(p)); }
+
+    void init(int n, int tag_base = 0) {
+        num = n, base = tag_base, head = retire = 0, tail = 0;
+        auto &cur = this->cur_stat();
+        for(int i = 0; i < int(PHYS_NUM); ++i) cur.val[i] = 0, cur.ready[i] = 1;
+        for(int i = 0; i < ARCH_REGS; ++i) cur.map[i] = cur.arch[i] = i;
+        for(int i = 0; i < int(PHYS_NUM); ++i) refs[i] = i < ARCH_REGS;
+        for(int i = ARCH_REGS; i < num; ++i) free_list[tail++ % PHYS_NUM] = i;
+        this->nex_stat() = cur;
+    }
+
+    word read(byte p) {return this->cur_stat().val[local(p)]; }
+    bool ready(byte p) {return this->cur_stat().ready[local(p)]; }
+    void write(byte p, word data) {
+        if(p == 0) return ;
+        p = local(p);
+        this->nex_stat().val[p] = data;
+        this->nex_stat().ready[p] = 1;
+    }
+
+    byte lookup(int id) {return global(this->cur_stat().map[id]); }
+    word arch_read(int id) {
+        auto &cur = this->cur_stat();
+        return cur.val[cur.arch[id]];
+    }
+    // set a committed register in place, only while nothing is in flight; one still shared
+    // after move elimination gets a register of its own first
+    void arch_write(int id, word data) {
+        if(id == 0) return ;
+        auto &cur = this->cur_stat(), &nex = this->nex_stat();
+        byte p = nex.arch[id];
+        if(refs[p] > 1) {
+            refs[p]--;
+            p = free_list[head++ % PHYS_NUM], retire++;
+            refs[p] = 1;
+            cur.arch[id] = cur.map[id] = nex.arch[id] = nex.map[id] = p;
+            cur.ready[p] = nex.ready[p] = 1;
+        }
+        cur.val[p] = nex.val[p] = data;
+    }
+
+    int free_count() {return tail - head; }
+    byte rename(int id) {
+        if(id == 0) return 0;
+        byte p = free_list[head++ % PHYS_NUM];
+        this->nex_stat().map[id] = p;
+        this->nex_stat().ready[p] = 0;
+        refs[p] = 1;
+        return global(p);
+    }
+    // map `id` onto the register already holding `src`, eliminating a move
+    byte share(int id, int src) {
+        byte p = this->cur_stat().map[src];
+        if(id == 0) return 0;
+        this->nex_stat().map[id] = p;
+        refs[p]++;
+        return global(p);
+    }
+    // `id` now lives in `p` architecturally, its previous register is released;
+    // `alloc` tells whether `p` came from the free list at rename
+    void commit(int id, byte p, bool alloc = 1) {
+        if(id == 0) return ;
+        auto &nex = this->nex_stat();
+        byte old = nex.arch[id];
+        nex.arch[id] = local(p);
+        if(alloc) retire++;
+        free_reg(old);
+    }
+
+    // the speculative map as the next instruction sees it
+    Checkpoint checkpoint() {
+        Checkpoint ret;
+        for(int i = 0; i < ARCH_REGS; ++i) ret.map[i] = this->nex_stat().map[i];
+        ret.head = head;
+        return ret;
+    }
+    // back to a checkpoint, registers allocated since return to the free list;
+    // moves eliminated since must be released one by one
+    void restore(const Checkpoint &ckpt) {
+        for(int i = 0; i < ARCH_REGS; ++i) this->nex_stat().map[i] = ckpt.map[i];
+        head = ckpt.head;
+    }
+
+    // back to the committed state, every in-flight allocation returns to the free list
+    void flush() {
+        auto &nex = this->nex_stat();
+        for(int i = 0; i < ARCH_REGS; ++i) nex.map[i] = nex.arch[i];
+        head = retire;
+        for(int i = 0; i < int(PHYS_NUM); ++i) refs[i] = 0;
+        for(int i = 1; i < ARCH_REGS; ++i) refs[nex.arch[i]]++;
+    }
+
+    void print() {
+        for(int i = 0; i < 4; ++i) {
+            for(int j = 0; j < 8; ++j) {
+                std::cout << std::setw(8) << std::setfill('0') << std::hex << arch_read(i*8+j);
+                std::cout << " ";
+            }
+            std::cout << '\n';
+        }
+    }
+
+};
+
 template <typename T, size_t DELAY_TIME>
 class Delay {
 private:
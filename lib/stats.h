@@ -0,0 +1,169 @@
+#ifndef __RISCV_SIMULATOR_STATS_H__
+#define __RISCV_SIMULATOR_STATS_H__
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace riscv {
+
+// why a stage did nothing in a cycle, the first obstacle it ran into
+enum Stall_reason {
+    FETCH_QUEUE_FULL,   // the instruction queue had no room
+    FETCH_STALLED,      // fetch waits behind a jalr, a serializing instruction, a vector store or the halt
+    FETCH_ICACHE,       // the instruction cache line is not there yet
+    FETCH_FLUSH,        // a flush or squash threw away what fetch did
+    ISSUE_EMPTY,        // nothing in the instruction queue
+    ISSUE_ROB_FULL,
+    ISSUE_RS_FULL,
+    ISSUE_SLB_FULL,     // the store/load buffer, or the lsq with --lsq
+    ISSUE_NO_REG,       // no free physical register
+    CDB_BUSY,           // a result waited in send_que while the cdb carried another
+    COMMIT_EMPTY,       // the reorder buffer is empty
+    COMMIT_WAIT,        // its head has no result yet
+    COMMIT_STORE_BUF,   // the store buffer refused the store at the head
+    COMMIT_SERIAL,      // an atomic, fence or csr access waits for the stores to drain or its cache access
+    STALL_REASONS
+};
+
+// top-down accounting of the single commit slot per cycle
+enum Cpi_slot {
+    CPI_RETIRING,
+    CPI_FRONTEND,       // the reorder buffer ran dry
+    CPI_BAD_SPEC,       // ... because it is refilling after a flush or squash, or the head replays
+    CPI_MEMORY,         // the head is a memory access, or waits for memory to drain
+    CPI_CORE,           // the head is any other unfinished instruction
+    CPI_SLOTS
+};
+
+inline const char* stall_name(int r) {
+    static const char *names[STALL_REASONS] = {
+        "fetch_queue_full", "fetch_stalled", "fetch_icache", "fetch_flush",
+        "issue_empty", "issue_rob_full", "issue_rs_full", "issue_slb_full", "issue_no_reg",
+        "cdb_busy",
+        "commit_empty", "commit_wait", "commit_store_buffer", "commit_serial"
+    };
+    return names[r];
+}
+
+inline const char* cpi_name(int s) {
+    static const char *names[CPI_SLOTS] = {"retiring", "frontend", "bad_speculation", "memory", "core"};
+    return names[s];
+}
+
+// occupancy samples of a structure with at most `cap` entries
+class Histogram {
+private:
+    std::vector<long long> cnt;
+
+public:
+    void init(int cap) {cnt.assign(cap + 1, 0); }
+    void add(int n) {cnt[n < int(cnt.size())? n: cnt.size() - 1]++; }
+
+    double mean() const {
+        long long total = 0, sum = 0;
+        for(size_t i = 0; i < cnt.size(); ++i) total += cnt[i], sum += cnt[i] * i;
+        return total? 1.0 * sum / total: 0.0;
+    }
+    void write(FILE *fp) const {
+        fprintf(fp, "{\"mean\": %.4f, \"counts\": [", mean());
+        for(size_t i = 0; i < cnt.size(); ++i) fprintf(fp, "%s%lld", i? ", ": "", cnt[i]);
+        fprintf(fp, "]}");
+    }
+};
+
+struct Stat_counters {
+    long long insts, cycles;
+    long long stall[STALL_REASONS];
+    long long cpi[CPI_SLOTS];
+
+    Stat_counters operator - (const Stat_counters &o) const {
+        Stat_counters ret = *this;
+        ret.insts -= o.insts, ret.cycles -= o.cycles;
+        for(int i = 0; i < STALL_REASONS; ++i) ret.stall[i] -= o.stall[i];
+        for(int i = 0; i < CPI_SLOTS; ++i) ret.cpi[i] -= o.cpi[i];
+        return ret;
+    }
+
+    // the json members of one record, without braces
+    void write(FILE *fp) const {
+        fprintf(fp, "\"instructions\": %lld, \"cycles\": %lld, \"ipc\": %.4f, \"stalls\": {", insts, cycles, cycles? 1.0 * insts / cycles: 0.0);
+        for(int i = 0; i < STALL_REASONS; ++i) fprintf(fp, "%s\"%s\": %lld", i? ", ": "", stall_name(i), stall[i]);
+        fprintf(fp, "}, \"cpi\": {");
+        for(int i = 0; i < CPI_SLOTS; ++i) fprintf(fp, "%s\"%s\": %.4f", i? ", ": "", cpi_name(i), insts? 1.0 * cpi[i] / insts: 0.0);
+        fprintf(fp, "}");
+    }
+};
+
+// per-core pipeline statistics: stall reasons, the cpi stack and occupancy histograms, counted
+// while the core simulates in detail, and written as one json object with a record per
+// `interval` committed instructions followed by the totals
+class Pipeline_stats {
+private:
+    Stat_counters now, last;
+    Histogram rs, slb, rob, send_que;
+    FILE *fp;
+    long long interval;
+    int records;
+
+    void write_interval() {
+        fprintf(fp, "%s\n  {", records++? ",": "");
+        (now - last).write(fp);
+        fprintf(fp, "}");
+        last = now;
+    }
+
+public:
+    Pipeline_stats(): fp(nullptr), interval(0), records(0) {
+        now = last = Stat_counters{};
+    }
+    ~Pipeline_stats() {close(); }
+
+    void init(int rs_cap, int slb_cap, int rob_cap, int que_cap) {
+        rs.init(rs_cap), slb.init(slb_cap), rob.init(rob_cap), send_que.init(que_cap);
+    }
+
+    bool open(const std::string &path, long long every) {
+        fp = fopen(path.c_str(), "w");
+        if(!fp) return 0;
+        interval = every;
+        fprintf(fp, "{\"interval\": %lld, \"intervals\": [", interval);
+        return 1;
+    }
+    bool opened() {return fp != nullptr; }
+
+    void stall(Stall_reason r) {now.stall[r]++; }
+    void slot(Cpi_slot s) {now.cpi[s]++; }
+    void retire() {now.insts++; }
+
+    // once per detailed cycle, after the stages ran
+    void sample(int rs_len, int slb_len, int rob_len, int que_len) {
+        now.cycles++;
+        rs.add(rs_len), slb.add(slb_len), rob.add(rob_len), send_que.add(que_len);
+        if(fp && now.insts - last.insts >= interval) write_interval();
+    }
+
+    const Stat_counters& total() const {return now; }
+
+    void close() {
+        if(!fp) return ;
+        if(now.insts > last.insts) write_interval();
+        fprintf(fp, "\n], \"total\": {");
+        now.write(fp);
+        fprintf(fp, ", \"occupancy\": {\"rs\": ");
+        rs.write(fp);
+        fprintf(fp, ", \"slb\": ");
+        slb.write(fp);
+        fprintf(fp, ", \"rob\": ");
+        rob.write(fp);
+        fprintf(fp, ", \"send_que\": ");
+        send_que.write(fp);
+        fprintf(fp, "}}}\n");
+        fclose(fp);
+        fp = nullptr;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef __RISCV_SIMULATOR_STORE_BUFFER_H__
+#define __RISCV_SIMULATOR_STORE_BUFFER_H__
+
+#include "utils.h"
+#include "ram.h"
+#include "cache.h"
+#include <deque>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+namespace riscv {
+
+// committed stores on their way to memory, drained in order one entry per cycle;
+// with a capacity, a store to the line of the youngest entry merges into it and the
+// whole entry costs one write access, without one every store keeps its own entry
+template <size_t MEM_SIZE>
+class Store_buffer {
+private:
+    struct Entry {
+        addr_t addr;                // first store of the entry, the address the write access uses
+        addr_t line;
+        std::vector<byte> data;
+        std::vector<bool> valid;
+        int ticket;
+    };
+
+    RAM<MEM_SIZE> &ram;
+    Memory_level *mem;
+    int capacity;               // 0 for unbounded and no coalescing
+    addr_t line_size;
+    std::deque<Entry> que;
+
+    long long stores, merged, full_stalls, forwarded;
+
+    Entry make(addr_t addr) {
+        Entry e;
+        e.addr = addr, e.line = addr / line_size;
+        e.data.assign(line_size, 0);
+        e.valid.assign(line_size, 0);
+        e.ticket = mem->request(addr, 1);
+        return e;
+    }
+
+    // the youngest entry holding `addr`, nullptr if none
+    const Entry* find(addr_t addr) {
+        for(auto it = que.rbegin(); it != que.rend(); ++it) {
+            if(it->line == addr / line_size && it->valid[addr % line_size]) return &*it;
+        }
+        return nullptr;
+    }
+
+public:
+    Store_buffer(RAM<MEM_SIZE> &ram_ref): ram(ram_ref), mem(nullptr), capacity(0), line_size(64) {}
+
+    void init(Memory_level *dmem, int entries, int line) {
+        mem = dmem, capacity = entries, line_size = line;
+        que.clear();
+        stores = merged = full_stalls = forwarded = 0;
+    }
+
+    bool empty() {return que.empty(); }
+    bool coalescing() {return capacity > 0; }
+
+    // whether a store of `len` bytes at `addr` can be taken this cycle
+    bool accept(addr_t addr, int len) {
+        if(!capacity) return 1;
+        addr_t first = addr / line_size, last = (addr + len - 1) / line_size;
+        int need = last - first + 1;
+        if(!que.empty() && que.back().line == first) need--;
+        if(int(que.size()) + need <= capacity) return 1;
+        full_stalls++;
+        return 0;
+    }
+
+    void push(addr_t addr, word data, int len) {
+        stores++;
+        for(int i = 0; i < len; ++i) {
+            addr_t cur = addr + i;
+            bool merge = (i || capacity) && !que.empty() && que.back().line == cur / line_size;
+            if(!merge) que.push_back(make(cur));
+            else if(i == 0) merged++;
+            que.back().data[cur % line_size] = data >> (i * 8) & 255;
+            que.back().valid[cur % line_size] = 1;
+        }
+    }
+
+    // memory as seen by this hart's loads
+    byte read(addr_t addr) {
+        auto *e = find(addr);
+        return e? e->data[addr % line_size]: ram.read_byte(addr);
+    }
+    // whether every byte of an access is still in the buffer
+    bool covers(addr_t addr, int len) {
+        for(int i = 0; i < len; ++i) {
+            if(!find(addr + i)) return 0;
+        }
+        forwarded++;
+        return 1;
+    }
+
+    // retry refused write accesses, and write the oldest entry back once its access is done
+    void drain() {
+        for(auto &e: que) {
+            if(e.ticket < 0) e.ticket = mem->request(e.addr, 1);
+        }
+        if(que.empty() || que.front().ticket < 0 || !mem->ready(que.front().ticket)) return ;
+        auto &e = que.front();
+        for(addr_t i = 0; i < line_size; ++i) {
+            if(e.valid[i]) ram.write_byte(e.line * line_size + i, e.data[i]);
+        }
+        mem->release(e.ticket);
+        que.pop_front();
+    }
+
+    void print() {
+        if(que.empty()) std::cout << "empty";
+        std::cout << "\n";
+        for(auto &e: que) {
+            std::cout << std::setw(8) << std::setfill('0') << std::hex << word(e.line * line_size) << " ";
+            for(addr_t i = 0; i < line_size; ++i) {
+                if(e.valid[i]) std::cout << std::setw(2) << std::setfill('0') << std::hex << word(e.data[i]);
+                else std::cout << "..";
+            }
+            std::cout << "\n";
+        }
+    }
+
+    void report(std::ostream &os) {
+        os << "[store buffer] " << capacity << " entries of " << line_size << "B, stores " << stores;
+        os << " coalesced " << merged << " full " << full_stalls << " loads forwarded " << forwarded << '\n';
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef __RISCV_SIMULATOR_STORE_SET_H__
+#define __RISCV_SIMULATOR_STORE_SET_H__
+
+#include "utils.h"
+#include <vector>
+#include <algorithm>
+
+namespace riscv {
+
+// store-set memory dependence predictor: loads and stores that once conflicted share a set
+// through the pc-indexed SSIT, and the LFST remembers the last store of each set in flight,
+// which a load of the set has to wait for; everything else a load may pass speculatively
+class Store_set {
+private:
+    int ssit_bits;
+    std::vector<int> ssit;      // set id, -1 for none
+    std::vector<byte> lfst;     // rob tag of the last store issued in the set, 0 for none
+    int next_set;
+
+    size_t index(addr_t pc) const {
+        return (pc >> 1 ^ pc >> (ssit_bits + 1)) & ((1u << ssit_bits) - 1);
+    }
+
+public:
+    explicit Store_set(int ssit_log = 10, int sets = 128): ssit_bits(ssit_log) {
+        ssit.assign(size_t(1) << ssit_bits, -1);
+        lfst.assign(sets, 0);
+        next_set = 0;
+    }
+
+    // a memory operation enters the window, returns the tag of the store it must wait for
+    byte dispatch(addr_t pc, bool store, byte tag) {
+        int id = ssit[index(pc)];
+        if(id < 0) return 0;
+        if(store) {
+            lfst[id] = tag;
+            return 0;
+        }
+        return lfst[id];
+    }
+    // the store left the window
+    void retire(addr_t pc, byte tag) {
+        int id = ssit[index(pc)];
+        if(id >= 0 && lfst[id] == tag) lfst[id] = 0;
+    }
+
+    // the load at `load_pc` read memory before the store at `store_pc` it depends on
+    void violation(addr_t load_pc, addr_t store_pc) {
+        int &ld = ssit[index(load_pc)], &st = ssit[index(store_pc)];
+        if(ld < 0 && st < 0) ld = st = next_set++ % int(lfst.size());
+        else if(ld < 0) ld = st;
+        else if(st < 0) st = ld;
+        else ld = st = std::min(ld, st);
+    }
+
+    void flush() {
+        std::fill(lfst.begin(), lfst.end(), 0);
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef __RISCV_SIMULATOR_SYSCALL_H__
+#define __RISCV_SIMULATOR_SYSCALL_H__
+
+#include "utils.h"
+#include "ram.h"
+#include <mutex>
+#include <string>
+#include <cstdio>
+
+namespace riscv {
+
+// the system calls newlib needs (riscv linux numbering), run on the host on behalf of the guest;
+// one instance is shared by all harts
+template <size_t MEM_SIZE>
+class Syscall {
+public:
+    enum {
+        SYS_CLOSE = 57, SYS_READ = 63, SYS_WRITE = 64, SYS_FSTAT = 80,
+        SYS_EXIT = 93, SYS_EXIT_GROUP = 94, SYS_CLOCK_GETTIME = 113, SYS_BRK = 214
+    };
+    const static int ERR_BADF = 9, ERR_FAULT = 14, ERR_NOSYS = 38;     // linux errno values
+    const static long long CLOCK_HZ = 1000000000;   // guest time is the cycle count at 1 GHz
+    const static size_t OUT_BUFFER = 1 << 16;
+    const static int STAT_SIZE = 128;               // struct kernel_stat of libgloss on rv32
+
+    struct Result {
+        word ret;
+        bool mem_write;     // guest memory changed, younger loads must be replayed
+        bool exit;
+    };
+
+private:
+    RAM<MEM_SIZE> &ram;
+    std::mutex mtx;
+    addr_t brk_addr;
+    std::string out;        // guest stdout, handed to the host in large chunks
+    FILE *in;
+    long long unknown;
+
+    bool valid(addr_t addr, word len) {
+        return addr <= MEM_SIZE && len <= MEM_SIZE - addr;
+    }
+
+    word sys_write(word fd, addr_t buf, word len) {
+        if(fd != 1 && fd != 2) return -ERR_BADF;
+        if(!valid(buf, len)) return -ERR_FAULT;
+        if(fd == 2) {
+            // keep both streams in program order
+            flush_out();
+            for(word i = 0; i < len; ++i) std::fputc(ram.read_byte(buf + i), stderr);
+            return len;
+        }
+        for(word i = 0; i < len; ++i) out.push_back(ram.read_byte(buf + i));
+        if(out.size() >= OUT_BUFFER) flush_out();
+        return len;
+    }
+
+    word sys_read(word fd, addr_t buf, word len) {
+        if(fd != 0) return -ERR_BADF;
+        if(!valid(buf, len)) return -ERR_FAULT;
+        if(!in) return 0;
+        word cnt = 0;
+        for(int ch; cnt < len && (ch = std::fgetc(in)) != EOF; ++cnt) ram.write_byte(buf + cnt, ch);
+        return cnt;
+    }
+
+    word sys_fstat(word fd, addr_t buf) {
+        if(fd > 2) return -ERR_BADF;
+        if(!valid(buf, STAT_SIZE)) return -ERR_FAULT;
+        for(int i = 0; i < STAT_SIZE; ++i) ram.write_byte(buf + i, 0);
+        ram.write_word(buf + 16, 0020620);     // st_mode: character device, so newlib line-buffers stdout
+        ram.write_word(buf + 20, 1);           // st_nlink
+        ram.write_word(buf + 56, 1024);        // st_blksize
+        return 0;
+    }
+
+    word sys_clock_gettime(addr_t buf, long long cycle) {
+        if(!valid(buf, 12)) return -ERR_FAULT;
+        long long sec = cycle / CLOCK_HZ, nsec = cycle % CLOCK_HZ * (1000000000 / CLOCK_HZ);
+        ram.write_word(buf, sec);
+        ram.write_word(buf + 4, sec >> 32);
+        ram.write_word(buf + 8, nsec);
+        return 0;
+    }
+
+    word sys_brk(addr_t addr) {
+        if(addr >= brk_addr && addr <= MEM_SIZE) brk_addr = addr;
+        return brk_addr;
+    }
+
+    void flush_out() {
+        if(out.empty()) return ;
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        std::fflush(stdout);
+        out.clear();
+    }
+
+public:
+    explicit Syscall(RAM<MEM_SIZE> &mem): ram(mem), brk_addr(0), in(nullptr), unknown(0) {}
+    ~Syscall() {
+        if(in) std::fclose(in);
+    }
+
+    // guest stdin, the program image itself arrives on the host stdin
+    bool open_input(const std::string &path) {
+        in = std::fopen(path.c_str(), "rb");
+        return in != nullptr;
+    }
+    // the heap starts right after the loaded image
+    void set_brk(addr_t addr) {
+        brk_addr = (addr + 15) & ~15u;
+    }
+
+    Result call(word num, word a0, word a1, word a2, long long cycle) {
+        std::lock_guard<std::mutex> lock(mtx);
+        switch(num) {
+            case SYS_WRITE: return Result{sys_write(a0, a1, a2), 0, 0};
+            case SYS_READ: return Result{sys_read(a0, a1, a2), 1, 0};
+            case SYS_FSTAT: return Result{sys_fstat(a0, a1), 1, 0};
+            case SYS_CLOCK_GETTIME: return Result{sys_clock_gettime(a1, cycle), 1, 0};
+            case SYS_BRK: return Result{sys_brk(a0), 0, 0};
+            case SYS_CLOSE: return Result{word(a0 > 2? -ERR_BADF: 0), 0, 0};
+            case SYS_EXIT: case SYS_EXIT_GROUP: flush_out(); return Result{a0, 0, 1};
+            default:
+                if(!unknown++) std::cerr << "unsupported system call " << std::dec << num << '\n';
+                return Result{word(-ERR_NOSYS), 0, 0};
+        }
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> lock(mtx);
+        flush_out();
+    }
+
+};
+
+}
+
+#endif
@@ -2,6 +2,8 @@
 #define __RISCV_SIMULATOR_UTILITY_H__
 
 #include <iostream>
+#include <mutex>
+#include <condition_variable>
 
 namespace riscv {
 
@@ -94,6 +96,11 @@ public:
         return 1;
     }
     void clear() {len = head = tail = 0; }
+    // drop the entry at `pos` and everything behind it
+    void cut(int pos) {
+        tail = (pos + MAX_LEN - 1) % MAX_LEN;
+        len = (tail - head + MAX_LEN) % MAX_LEN;
+    }
     bool empty() {return len == 0; }
     bool full() {return len >= MAX_LEN - 1; }
     int length() {return len; }
@@ -151,6 +158,30 @@ public:
 
 };
 
+// reusable barrier for host threads; the last thread to arrive runs `done` before releasing the others
+class Barrier {
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    int num, arrived;
+    long long phase;
+
+public:
+    explicit Barrier(int n): num(n), arrived(0), phase(0) {}
+
+    template <typename F>
+    void wait(F done) {
+        std::unique_lock<std::mutex> lock(mtx);
+        long long cur = phase;
+        if(++arrived == num) {
+            done();
+            arrived = 0, phase++;
+            cv.notify_all();
+        }
+        else cv.wait(lock, [&]() {return phase != cur; });
+    }
+};
+
 template <typename T, size_t MAX_LEN = 32>
 class SeqQueue: public Sequential< Queue<T, MAX_LEN> > {
 public:
@@ -169,6 +200,31 @@ public:
     bool full() {
         return this->cur_stat().full();
     }
+    int size() {
+        return this->cur_stat().length();
+    }
+    int capacity() {
+        return MAX_LEN - 1;
+    }
+    // k-th element from the front
+    T peek(int k) {
+        auto &cur = this->cur_stat();
+        return cur[(cur.begin() + k) % MAX_LEN];
+    }
+    template <typename F>
+    void remove_if(F pred) {
+        auto old = this->nex_stat();
+        auto &nex = this->nex_stat();
+        nex.clear();
+        for(int i = old.begin(); i != old.end(); i = old.next(i)) {
+            if(!pred(old[i])) nex.push(old[i]);
+        }
+    }
+    template <typename F>
+    void each(F f) {
+        auto &nex = this->nex_stat();
+        for(int i = nex.begin(); i != nex.end(); i = nex.next(i)) f(nex[i]);
+    }
     void flush() {
         this->nex_stat().clear();
     }
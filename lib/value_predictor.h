@@ -0,0 +1,86 @@
+#ifndef __RISCV_SIMULATOR_VALUE_PREDICTOR_H__
+#define __RISCV_SIMULATOR_VALUE_PREDICTOR_H__
+
+#include "utils.h"
+#include <vector>
+#include <string>
+#include <iostream>
+
+namespace riscv {
+
+// pc-indexed load value predictor, trained with committed values: last-value predicts the
+// previous value again, stride adds the last difference once per instance still in flight;
+// a prediction is only used once the confidence counter saturates
+class Value_predictor {
+private:
+    struct Entry {
+        addr_t tag;
+        word last;
+        word stride;
+        int conf;
+        int inflight;       // dispatched instances not committed yet
+    };
+    const static int CONF_MAX = 7;
+
+    bool use_stride;
+    int bits;
+    std::vector<Entry> table;
+    long long loads, predicted, correct;
+
+    Entry& entry(addr_t pc) {
+        return table[(pc >> 1) & ((1u << bits) - 1)];
+    }
+
+public:
+    Value_predictor(bool stride, int index_bits = 10): use_stride(stride), bits(index_bits) {
+        table.assign(size_t(1) << bits, Entry{0, 0, 0, 0, 0});
+        loads = predicted = correct = 0;
+    }
+
+    // a load at `pc` is dispatched, returns whether `val` holds a confident prediction
+    bool predict(addr_t pc, word &val) {
+        auto &e = entry(pc);
+        loads++;
+        if(e.tag != pc) {
+            e = Entry{pc, 0, 0, 0, 1};
+            return 0;
+        }
+        val = use_stride? e.last + e.stride * (e.inflight + 1): e.last;
+        e.inflight++;
+        if(e.conf < CONF_MAX) return 0;
+        predicted++;
+        return 1;
+    }
+    // the load at `pc` committed with `val`, `used` tells whether it was predicted
+    void train(addr_t pc, word val, bool used, bool hit) {
+        auto &e = entry(pc);
+        correct += used && hit;
+        if(e.tag != pc) return ;
+        if(e.inflight) e.inflight--;
+        word stride = use_stride? val - e.last: 0;
+        if(stride == e.stride && (use_stride || val == e.last)) {
+            if(e.conf < CONF_MAX) e.conf++;
+        }
+        else e.conf = 0;
+        e.stride = stride, e.last = val;
+    }
+    // an in-flight instance was squashed
+    void cancel(addr_t pc) {
+        auto &e = entry(pc);
+        if(e.tag == pc && e.inflight) e.inflight--;
+    }
+    void flush() {
+        for(auto &e: table) e.inflight = 0;
+    }
+
+    void report(std::ostream &os) {
+        os << "[value predictor] " << (use_stride? "stride": "last-value") << " loads " << loads;
+        os << " predicted " << predicted << " correct " << correct;
+        os << " coverage " << (loads? 1.0 * predicted / loads: 0.0);
+        os << " accuracy " << (predicted? 1.0 * correct / predicted: 1.0) << '\n';
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef __RISCV_SIMULATOR_VECTOR_H__
+#define __RISCV_SIMULATOR_VECTOR_H__
+
+#include "utils.h"
+#include "inst.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RISCV_SIMULATOR_X86 1
+#endif
+
+namespace riscv {
+
+struct Vector_config {
+    int vlen;       // bits of a vector register
+    int lanes;      // 32-bit lanes of the unit, narrower elements go several to a lane
+    int latency;    // cycles before the first element group leaves the unit
+
+    Vector_config(): vlen(256), lanes(4), latency(2) {}
+
+    // parse "key=val,..." with keys vlen, lanes, latency
+    static bool parse(const std::string &spec, Vector_config &cfg) {
+        std::stringstream ss(spec);
+        std::string item;
+        while(std::getline(ss, item, ',')) {
+            auto eq = item.find('=');
+            if(eq == std::string::npos) return 0;
+            auto key = item.substr(0, eq), val = item.substr(eq + 1);
+            char *end;
+            long num = std::strtol(val.c_str(), &end, 10);
+            if(*end || num <= 0) return 0;
+            if(key == "vlen") cfg.vlen = num;
+            else if(key == "lanes") cfg.lanes = num;
+            else if(key == "latency") cfg.latency = num;
+            else return 0;
+        }
+        bool pow2 = !(cfg.vlen & (cfg.vlen - 1)) && !(cfg.lanes & (cfg.lanes - 1));
+        return pow2 && cfg.vlen >= 64 && cfg.vlen <= 1024 && cfg.lanes * 32 <= cfg.vlen;
+    }
+};
+
+inline bool is_vector(RV32I_Opt opt) {return opt > VECTOR_BEG && opt < VECTOR_END; }
+inline bool is_vload(RV32I_Opt opt) {return opt == VLE || opt == VLSE; }
+inline bool is_vstore(RV32I_Opt opt) {return opt == VSE || opt == VSSE; }
+inline bool is_vreduce(RV32I_Opt opt) {return opt >= VREDSUM && opt <= VREDMAX; }
+
+// architectural vector state of a hart: 32 registers of vlen bits, vl and vtype;
+// only lmul 1 is supported, any other vtype sets vill
+class Vector_regfile {
+private:
+    int vlen;
+    std::vector<byte> data;
+
+public:
+    word vl, vtype;
+    int sew;        // element width in bits, 0 while vill is set
+
+    void init(int bits) {
+        vlen = bits, vl = 0, vtype = 1u << 31, sew = 0;
+        data.assign(32 * vlen / 8, 0);
+    }
+
+    byte* reg(int id) {return &data[id * vlen / 8]; }
+    int vlmax() {return sew? vlen / sew: 0; }
+
+    // vsetvl* with requested length `avl`, returns the new vl
+    word configure(word avl, word type) {
+        int vsew = Decoder::slice(type, 3, 6), vlmul = Decoder::slice(type, 0, 3);
+        bool ill = vsew > 2 || vlmul || (type >> 8);
+        vtype = ill? 1u << 31: type;
+        sew = ill? 0: 8 << vsew;
+        vl = avl < word(vlmax())? avl: vlmax();
+        return vl;
+    }
+
+    word element(int id, int i) {
+        word val = 0;
+        std::memcpy(&val, reg(id) + i * sew / 8, sew / 8);
+        return val;
+    }
+    void set_element(int id, int i, word val) {
+        std::memcpy(reg(id) + i * sew / 8, &val, sew / 8);
+    }
+};
+
+// element-wise and reduction kernels on little-endian register images: add, sub and the
+// bitwise ops use sse2, and with avx2 present at run time also mul, min and max; whatever
+// the host cannot do in simd, and the tails, run element by element
+class Vector_alu {
+private:
+    static word sext(word val, int sew) {return sew == 32? val: Decoder::sext(val, sew); }
+    static word mask(word val, int sew) {return sew == 32? val: val & ((1u << sew) - 1); }
+
+    static word scalar(RV32I_Opt opt, int sew, word a, word b) {
+        word sa = sext(a, sew), sb = sext(b, sew);
+        switch(opt) {
+            case VADD: case VREDSUM: return a + b;
+            case VSUB: return a - b;
+            case VRSUB: return b - a;
+            case VAND: case VREDAND: return a & b;
+            case VOR: case VREDOR: return a | b;
+            case VXOR: case VREDXOR: return a ^ b;
+            case VMUL: return a * b;
+            case VMINU: case VREDMINU: return mask(a, sew) < mask(b, sew)? a: b;
+            case VMIN: case VREDMIN: return signed(sa) < signed(sb)? a: b;
+            case VMAXU: case VREDMAXU: return mask(a, sew) > mask(b, sew)? a: b;
+            case VMAX: case VREDMAX: return signed(sa) > signed(sb)? a: b;
+            case VMV: return b;
+            default: return 0;
+        }
+    }
+
+#ifdef RISCV_SIMULATOR_X86
+    // bytes done with sse2, a multiple of 16
+    static int sse2(RV32I_Opt opt, int sew, byte *dst, const byte *a, const byte *b, int bytes) {
+        int i = 0;
+        for(; i + 16 <= bytes; i += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+            __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+            __m128i z;
+            switch(opt) {
+                case VADD: z = sew == 8? _mm_add_epi8(x, y): sew == 16? _mm_add_epi16(x, y): _mm_add_epi32(x, y); break;
+                case VSUB: z = sew == 8? _mm_sub_epi8(x, y): sew == 16? _mm_sub_epi16(x, y): _mm_sub_epi32(x, y); break;
+                case VRSUB: z = sew == 8? _mm_sub_epi8(y, x): sew == 16? _mm_sub_epi16(y, x): _mm_sub_epi32(y, x); break;
+                case VAND: z = _mm_and_si128(x, y); break;
+                case VOR: z = _mm_or_si128(x, y); break;
+                case VXOR: z = _mm_xor_si128(x, y); break;
+                case VMV: z = y; break;
+                default: return i;
+            }
+            _mm_storeu_si128((__m128i*)(dst + i), z);
+        }
+        return i;
+    }
+
+    // bytes done with avx2, a multiple of 32
+    __attribute__((target("avx2")))
+    static int avx2(RV32I_Opt opt, int sew, byte *dst, const byte *a, const byte *b, int bytes) {
+        int i = 0;
+        for(; i + 32 <= bytes; i += 32) {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+            __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+            __m256i z;
+            switch(opt) {
+                case VADD: z = sew == 8? _mm256_add_epi8(x, y): sew == 16? _mm256_add_epi16(x, y): _mm256_add_epi32(x, y); break;
+                case VSUB: z = sew == 8? _mm256_sub_epi8(x, y): sew == 16? _mm256_sub_epi16(x, y): _mm256_sub_epi32(x, y); break;
+                case VRSUB: z = sew == 8? _mm256_sub_epi8(y, x): sew == 16? _mm256_sub_epi16(y, x): _mm256_sub_epi32(y, x); break;
+                case VAND: z = _mm256_and_si256(x, y); break;
+                case VOR: z = _mm256_or_si256(x, y); break;
+                case VXOR: z = _mm256_xor_si256(x, y); break;
+                case VMV: z = y; break;
+                case VMUL:
+                    if(sew == 8) return i;
+                    z = sew == 16? _mm256_mullo_epi16(x, y): _mm256_mullo_epi32(x, y);
+                    break;
+                case VMINU: z = sew == 8? _mm256_min_epu8(x, y): sew == 16? _mm256_min_epu16(x, y): _mm256_min_epu32(x, y); break;
+                case VMIN: z = sew == 8? _mm256_min_epi8(x, y): sew == 16? _mm256_min_epi16(x, y): _mm256_min_epi32(x, y); break;
+                case VMAXU: z = sew == 8? _mm256_max_epu8(x, y): sew == 16? _mm256_max_epu16(x, y): _mm256_max_epu32(x, y); break;
+                case VMAX: z = sew == 8? _mm256_max_epi8(x, y): sew == 16? _mm256_max_epi16(x, y): _mm256_max_epi32(x, y); break;
+                default: return i;
+            }
+            _mm256_storeu_si256((__m256i*)(dst + i), z);
+        }
+        return i;
+    }
+
+    // 32-bit sum of whole 32-byte blocks
+    __attribute__((target("avx2")))
+    static word avx2_sum(const byte *a, int blocks) {
+        __m256i acc = _mm256_setzero_si256();
+        for(int i = 0; i < blocks; ++i) acc = _mm256_add_epi32(acc, _mm256_loadu_si256((const __m256i*)(a + i * 32)));
+        word part[8];
+        _mm256_storeu_si256((__m256i*)part, acc);
+        word sum = 0;
+        for(int i = 0; i < 8; ++i) sum += part[i];
+        return sum;
+    }
+#endif
+
+    bool has_avx2;
+
+public:
+    Vector_alu() {
+#ifdef RISCV_SIMULATOR_X86
+        has_avx2 = __builtin_cpu_supports("avx2");
+#else
+        has_avx2 = 0;
+#endif
+    }
+
+    // dst[i] = a[i] op b[i] for the first n elements, a is vs2 and b vs1 or the broadcast scalar
+    void calc(RV32I_Opt opt, int sew, byte *dst, const byte *a, const byte *b, int n) {
+        int bytes = n * sew / 8, done = 0;
+#ifdef RISCV_SIMULATOR_X86
+        if(has_avx2) done = avx2(opt, sew, dst, a, b, bytes);
+        done += sse2(opt, sew, dst + done, a + done, b + done, bytes - done);
+#endif
+        for(int i = done * 8 / sew; i < n; ++i) {
+            word x = 0, y = 0;
+            std::memcpy(&x, a + i * sew / 8, sew / 8);
+            std::memcpy(&y, b + i * sew / 8, sew / 8);
+            word z = scalar(opt, sew, x, y);
+            std::memcpy(dst + i * sew / 8, &z, sew / 8);
+        }
+    }
+
+    // `init` op a[0] op ... op a[n - 1]
+    word reduce(RV32I_Opt opt, int sew, word init, const byte *a, int n) {
+        word acc = init;
+        int i = 0;
+#ifdef RISCV_SIMULATOR_X86
+        if(has_avx2 && opt == VREDSUM && sew == 32) {
+            acc += avx2_sum(a, n / 8);
+            i = n / 8 * 8;
+        }
+#endif
+        for(; i < n; ++i) {
+            word x = 0;
+            std::memcpy(&x, a + i * sew / 8, sew / 8);
+            acc = scalar(opt, sew, acc, x);
+        }
+        return mask(acc, sew);
+    }
+};
+
+}
+
+#endif
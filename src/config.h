@@ -0,0 +1,170 @@
+#ifndef __RISCV_SIMULATOR_CONFIG_H__
+#define __RISCV_SIMULATOR_CONFIG_H__
+
+#include "../lib/predictor.h"
+#include "../lib/cache.h"
+#include "../lib/dram.h"
+#include "../lib/prefetcher.h"
+#include "../lib/vector.h"
+#include <string>
+#include <iostream>
+#include <cstdlib>
+
+namespace riscv {
+
+struct Config {
+    Predictor_config bp;
+    int bp_report;      // number of worst static branches reported, 0 for none
+    std::string branch_trace;
+    bool use_l1i, use_l1d, use_l2;
+    Cache_config l1i, l1d, l2;
+    int mem_latency;    // 0 picks 3 cycles for flat memory, 100 behind caches
+    bool use_dram;
+    Dram_config dram;
+    bool use_prefetch;
+    Prefetch_config prefetch;
+    bool use_vector;    // execute the vector subset, its encodings are dropped like illegal ones otherwise
+    Vector_config vector;
+    int cores;
+    int threads;        // host threads simulating the cores
+    int smt;            // hardware threads per core
+    std::string fetch_policy;   // which thread fetches with --smt: rr or icount
+    int quantum;        // cycles each core runs between barriers
+    int mul_latency, div_latency;
+    int fp_latency, fdiv_latency;
+    bool fusion;        // macro-op fusion and move elimination at issue
+    bool lsq;           // split load/store queue with out-of-order loads and forwarding
+    bool store_sets;    // loads pass unresolved stores unless the store-set predictor says otherwise
+    int store_buffer;   // entries of the coalescing store buffer, 0 keeps one unbounded entry per store
+    int loop_buffer;    // decoded instructions the loop buffer holds, 0 disables it
+    bool early_resolve; // branches recover when they execute, squashing only younger instructions
+    std::string value_pred; // load value predictor: empty, last or stride
+    bool roi;           // fast-forward functionally outside the region of interest markers
+    int phys_regs;      // physical registers, 64 of them hold the committed integer and floating point state
+    std::string input;  // guest stdin for the read system call
+    std::string pipe_trace; // Kanata log of every instruction's pipeline stages, empty for none
+    std::string commit_trace;   // binary trace of the committed instructions, empty for none
+    std::string stats;  // json file for the pipeline statistics, empty for none
+    long long stats_interval;   // committed instructions per interval record
+
+    Config(): bp_report(0), use_l1i(0), use_l1d(0), use_l2(0),
+        l1i(32 << 10, 8, 64, 1, 4), l1d(32 << 10, 8, 64, 3, 8), l2(256 << 10, 8, 64, 12, 16),
+        mem_latency(0), use_dram(0), use_prefetch(0), use_vector(0), cores(1), threads(1), smt(1), fetch_policy("icount"), quantum(100),
+        mul_latency(3), div_latency(32), fp_latency(4), fdiv_latency(16), fusion(0), lsq(0), store_sets(0), store_buffer(0), loop_buffer(0), early_resolve(0), roi(0), phys_regs(96), stats_interval(1000000) {}
+
+    static bool parse_cache(const std::string &val, bool &use, Cache_config &cache) {
+        if(val == "off") {use = 0; return 1; }
+        use = 1;
+        return Cache_config::parse(val, cache);
+    }
+
+    static void usage() {
+        std::cerr << "usage: code [options] < program\n";
+        std::cerr << "  --bp=NAME[:key=val,...]  branch predictor: bimodal, gshare, tournament, tage, perceptron\n";
+        std::cerr << "                           keys: index, history, local, tables, tag\n";
+        std::cerr << "                           index up to 24 bits (tage 20, perceptron 16), history up to 31\n";
+        std::cerr << "                           (tage 2047, perceptron 64), tables 1 to 16, tag 2 to 16\n";
+        std::cerr << "  --bp-report=N            report the N most mispredicted branches\n";
+        std::cerr << "  --branch-trace=FILE      dump committed conditional branches for bp_replay\n";
+        std::cerr << "  --cache                  enable the default L1I/L1D/L2 hierarchy\n";
+        std::cerr << "  --l1i=SPEC|off, --l1d=SPEC|off, --l2=SPEC|off\n";
+        std::cerr << "                           SPEC is key=val,... with keys size, assoc, line, latency, mshr,\n";
+        std::cerr << "                           policy (lru, fifo, random)\n";
+        std::cerr << "  --mem-latency=N          main memory latency in cycles\n";
+        std::cerr << "  --dram[=SPEC]            model main memory as DRAM, SPEC is key=val,... with keys\n";
+        std::cerr << "                           channels, banks, row, policy (open, closed), tRCD, tCAS,\n";
+        std::cerr << "                           tRP, tRAS, tBURST, queue\n";
+        std::cerr << "  --prefetch[=SPEC]        stride prefetcher in front of the L1D's lower level, SPEC is\n";
+        std::cerr << "                           key=val,... with keys degree, distance, entries, latency, table\n";
+        std::cerr << "  --vector[=SPEC]          vector unit for the rvv subset, SPEC is key=val,... with keys\n";
+        std::cerr << "                           vlen, lanes, latency\n";
+        std::cerr << "  --lsq                    split load/store queue, loads pass older stores with known addresses\n";
+        std::cerr << "  --store-sets             with --lsq, loads also pass older stores of unknown address\n";
+        std::cerr << "                           unless a store-set predictor links them, violations replay\n";
+        std::cerr << "  --store-buffer=N         post-commit store buffer of N entries coalescing same-line stores\n";
+        std::cerr << "  --fusion                 fuse lui/auipc+addi and auipc+jalr, eliminate moves at rename\n";
+        std::cerr << "  --loop-buffer=N          replay tight loops of up to N instructions (at most 256) without fetching them\n";
+        std::cerr << "  --early-resolve          recover from mispredictions when the branch executes\n";
+        std::cerr << "  --value-pred=last|stride predict load values at issue, squash dependents on a mismatch\n";
+        std::cerr << "  --phys-regs=N            size of the physical register file shared by x and f registers\n";
+        std::cerr << "                           (65 to 128)\n";
+        std::cerr << "  --roi                    simulate in detail only between the markers addi x0, x0, 1 and\n";
+        std::cerr << "                           addi x0, x0, 2, executing functionally elsewhere\n";
+        std::cerr << "  --pipe-trace=FILE        log fetch, issue, execute, write-back and commit of every\n";
+        std::cerr << "                           instruction in the Kanata format of the Konata viewer\n";
+        std::cerr << "  --commit-trace=FILE      write every committed instruction with its register write and\n";
+        std::cerr << "                           memory access to a compressed binary trace\n";
+        std::cerr << "  --stats=FILE             write stall reasons, a cpi stack and occupancy histograms as json\n";
+        std::cerr << "  --stats-interval=N       committed instructions per interval record of --stats\n";
+        std::cerr << "  --input=FILE             file read by the guest through fd 0\n";
+        std::cerr << "  --cores=N                number of harts sharing memory, all start at address 0\n";
+        std::cerr << "  --smt=N                  hardware threads per core (1 or 2) sharing its back end\n";
+        std::cerr << "  --fetch-policy=rr|icount which thread fetches each cycle with --smt\n";
+        std::cerr << "  --threads=N              host threads used to simulate the cores\n";
+        std::cerr << "  --mul-latency=N          cycles of the pipelined multiplier\n";
+        std::cerr << "  --div-latency=N          cycles of the iterative divider, which takes one operation at a time\n";
+        std::cerr << "  --fp-latency=N           cycles of the pipelined fp unit: fused multiply-add, add, mul, conversions\n";
+        std::cerr << "  --fdiv-latency=N         cycles of the iterative fp divider and square root\n";
+        std::cerr << "  --quantum=N              cycles a core runs before synchronizing with the others\n";
+    }
+
+    static Config parse(int argc, char *argv[]) {
+        Config cfg;
+        for(int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto eq = arg.find('=');
+            std::string key = arg.substr(0, eq);
+            std::string val = eq == std::string::npos? "": arg.substr(eq + 1);
+            bool ok = 1;
+            if(key == "--bp") ok = Predictor_config::parse(val, cfg.bp);
+            else if(key == "--bp-report") cfg.bp_report = std::atoi(val.c_str());
+            else if(key == "--branch-trace") cfg.branch_trace = val, ok = !val.empty();
+            else if(key == "--cache") cfg.use_l1i = cfg.use_l1d = cfg.use_l2 = 1;
+            else if(key == "--l1i") ok = parse_cache(val, cfg.use_l1i, cfg.l1i);
+            else if(key == "--l1d") ok = parse_cache(val, cfg.use_l1d, cfg.l1d);
+            else if(key == "--l2") ok = parse_cache(val, cfg.use_l2, cfg.l2);
+            else if(key == "--mem-latency") ok = (cfg.mem_latency = std::atoi(val.c_str())) > 0;
+            else if(key == "--dram") cfg.use_dram = 1, ok = Dram_config::parse(val, cfg.dram);
+            else if(key == "--prefetch") cfg.use_prefetch = 1, ok = Prefetch_config::parse(val, cfg.prefetch);
+            else if(key == "--vector") cfg.use_vector = 1, ok = Vector_config::parse(val, cfg.vector);
+            else if(key == "--cores") ok = (cfg.cores = std::atoi(val.c_str())) > 0;
+            else if(key == "--threads") ok = (cfg.threads = std::atoi(val.c_str())) > 0;
+            else if(key == "--quantum") ok = (cfg.quantum = std::atoi(val.c_str())) > 0;
+            else if(key == "--mul-latency") ok = (cfg.mul_latency = std::atoi(val.c_str())) > 0;
+            else if(key == "--div-latency") ok = (cfg.div_latency = std::atoi(val.c_str())) > 0;
+            else if(key == "--fp-latency") ok = (cfg.fp_latency = std::atoi(val.c_str())) > 0;
+            else if(key == "--fdiv-latency") ok = (cfg.fdiv_latency = std::atoi(val.c_str())) > 0;
+            else if(key == "--lsq") cfg.lsq = 1;
+            else if(key == "--store-sets") cfg.lsq = cfg.store_sets = 1;
+            else if(key == "--store-buffer") cfg.store_buffer = std::atoi(val.c_str()), ok = cfg.store_buffer > 0 && cfg.store_buffer <= 64;
+            else if(key == "--fusion") cfg.fusion = 1;
+            else if(key == "--loop-buffer") cfg.loop_buffer = std::atoi(val.c_str()), ok = cfg.loop_buffer >= 0 && cfg.loop_buffer <= 256;
+            else if(key == "--early-resolve") cfg.early_resolve = 1;
+            else if(key == "--roi") cfg.roi = 1;
+            else if(key == "--value-pred") cfg.value_pred = val, ok = val == "last" || val == "stride";
+            else if(key == "--phys-regs") cfg.phys_regs = std::atoi(val.c_str()), ok = cfg.phys_regs > 64 && cfg.phys_regs <= 128;
+            else if(key == "--smt") cfg.smt = std::atoi(val.c_str()), ok = cfg.smt >= 1 && cfg.smt <= 2;
+            else if(key == "--fetch-policy") cfg.fetch_policy = val, ok = val == "rr" || val == "icount";
+            else if(key == "--pipe-trace") cfg.pipe_trace = val, ok = !val.empty();
+            else if(key == "--commit-trace") cfg.commit_trace = val, ok = !val.empty();
+            else if(key == "--stats") cfg.stats = val, ok = !val.empty();
+            else if(key == "--stats-interval") ok = (cfg.stats_interval = std::atoll(val.c_str())) > 0;
+            else if(key == "--input") cfg.input = val, ok = !val.empty();
+            else ok = 0;
+            if(!ok) {
+                std::cerr << "invalid option: " << arg << '\n';
+                usage(), exit(1);
+            }
+        }
+        if(cfg.smt > 1 && cfg.lsq) {
+            // lsq entries refer to each other by slot, which dropping one thread's entries would shift
+            std::cerr << "--smt does not support --lsq or --store-sets\n";
+            exit(1);
+        }
+        return cfg;
+    }
+};
+
+}
+
+#endif
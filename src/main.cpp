@@ -1,9 +1,9 @@
 #include "simulator.h"
 
-int main() {
+int main(int argc, char *argv[]) {
 // freopen("../data/sample/sample.data", "r", stdin);
 // freopen("../test/tmp.out", "w", stdout);
-    riscv::simulator sim;
+    riscv::simulator sim(riscv::Config::parse(argc, argv));
     sim.scan();
     sim.run();
     return 0;
@@ -7,7 +7,29 @@
 #include "../lib/inst.h"
 #include "../lib/ram.h"
 #include "../lib/utils.h"
+#include "../lib/predictor.h"
+#include "../lib/branch_trace.h"
+#include "../lib/cache.h"
+#include "../lib/dram.h"
+#include "../lib/syscall.h"
+#include "../lib/store_buffer.h"
+#include "../lib/store_set.h"
+#include "../lib/value_predictor.h"
+#include "../lib/prefetcher.h"
+#include "../lib/vector.h"
+#include "../lib/fpu.h"
+#include "../lib/stats.h"
+#include "../lib/kanata.h"
+#include "../lib/commit_trace.h"
+#include "config.h"
 #include <tuple>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <deque>
+#include <thread>
+#include <functional>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
@@ -18,8 +40,14 @@ namespace riscv {
 
 using CDB_msg = std::tuple<byte, word, addr_t>;
 using CDB_reg = Register<CDB_msg>;
-using Store_msg = std::tuple<RV32I_Opt, word, addr_t>;
-using Load_msg = std::tuple<RV32I_Opt, word, word>;
+
+struct Mem_req {
+    RV32I_Opt opt;
+    byte ROBidx;
+    word data;
+    addr_t addr;
+    int ticket;
+};
 
 struct Buffer_item;
 struct ROB_item;
@@ -28,22 +56,29 @@ class RS;
 class ROB;
 class SLB;
 
+inline bool is_load(RV32I_Opt opt) {return opt > LOAD_BEG && opt < LOAD_END; }
+inline bool is_store(RV32I_Opt opt) {return opt > STORE_BEG && opt < STORE_END; }
+inline bool is_branch(RV32I_Opt opt) {return opt > BRANCH_BEG && opt < BRANCH_END; }
+inline bool is_fp(RV32I_Opt opt) {return opt > FP_BEG && opt < FP_END; }
+inline bool is_fma(RV32I_Opt opt) {return opt >= FMADD_S && opt <= FNMADD_S; }
+
 struct Buffer_item {
     byte ROBidx;
     RV32I_Opt opt;
-    word val1, val2;
-    byte src1, src2;
-    imm_t imm;
+    word val1, val2, val3;
+    byte src1, src2, src3;  // the third operand is the addend of a fused multiply-add
+    imm_t imm;              // the rounding mode of floating point operations
 
     bool ready() {
-        return !src1 && !src2; 
+        return !src1 && !src2 && !src3; 
     }
     bool match(byte tag) {
-        return src1 == tag || src2 == tag;
+        return src1 == tag || src2 == tag || src3 == tag;
     }
     void update(int tag, word data) {
         if(src1 == tag) src1 = 0, val1 = data;
         if(src2 == tag) src2 = 0, val2 = data;
+        if(src3 == tag) src3 = 0, val3 = data;
     }    
 };
 
@@ -53,17 +88,26 @@ public:
     bool empty() {return this->cur_stat().empty(); }
     bool full() {return this->cur_stat().full(); }
     int size() {return this->cur_stat().length(); }
+    template <typename F>
+    int count(F pred) {
+        auto &clis = this->cur_stat();
+        int cnt = 0;
+        for(int i = clis.next(0); ~i; i = clis.next(i)) cnt += pred(clis[i].ROBidx);
+        return cnt;
+    }
 
     void issue(const Buffer_item &item) {
         int pos = this->nex_stat().allocate();
         this->nex_stat()[pos] = item;
     }
 
-    const Buffer_item* execute(CDB_reg &out) {
-        if(out.pending()) return nullptr;
+    // dispatches the ready operation in the lowest occupied slot that the unit behind `accept`
+    // can take; slots are reused as they free up, so this is not necessarily the oldest one
+    template <typename F>
+    const Buffer_item* execute(F accept) {
         auto &clis = this->cur_stat();
         for(int i = clis.next(0); ~i; i = clis.next(i)) {
-            if(clis[i].ready()) {
+            if(clis[i].ready() && accept(clis[i].opt)) {
                 this->nex_stat().deallocate(i);
                 return &clis[i];
             }
@@ -81,6 +125,14 @@ public:
         }
     }
 
+    template <typename F>
+    void squash(F younger) {
+        auto &nlis = this->nex_stat();
+        for(int i = nlis.next(0); ~i; i = nlis.next(i)) {
+            if(younger(nlis[i].ROBidx)) nlis.deallocate(i);
+        }
+    }
+
     void flush() {
         this->nex_stat().clear();
     }
@@ -109,6 +161,13 @@ public:
     bool full() {return this->cur_stat().full(); }
     bool empty() {return this->cur_stat().empty(); }
     int size() {return this->cur_stat().length(); }
+    template <typename F>
+    int count(F pred) {
+        auto &cque = this->cur_stat();
+        int cnt = 0;
+        for(int i = cque.begin(); i != cque.end(); i = cque.next(i)) cnt += pred(cque[i].ROBidx);
+        return cnt;
+    }
     
     void issue(const Buffer_item &item) {
         this->nex_stat().push(item);
@@ -143,6 +202,24 @@ public:
         }
     }
 
+    // the threads of a core interleave here, so the entries left keep their order but not their slots
+    template <typename F>
+    void squash(F younger) {
+        auto old = this->nex_stat();
+        auto &nque = this->nex_stat();
+        nque.clear();
+        for(int i = old.begin(); i != old.end(); i = old.next(i)) {
+            if(!younger(old[i].ROBidx)) nque.push(old[i]);
+        }
+    }
+    template <typename F>
+    int stores(F pred) {
+        auto &nque = this->nex_stat();
+        int cnt = 0;
+        for(int i = nque.begin(); i != nque.end(); i = nque.next(i)) cnt += is_store(nque[i].opt) && pred(nque[i].ROBidx);
+        return cnt;
+    }
+
     void flush() {
         this->nex_stat().clear();
     }
@@ -166,12 +243,246 @@ public:
 
 };
 
+inline int mem_width(RV32I_Opt opt) {
+    switch(opt) {
+        case LB: case LBU: case SB: return 1;
+        case LH: case LHU: case SH: return 2;
+        default: return 4;
+    }
+}
+
+struct Lsq_item {
+    Buffer_item op;
+    addr_t pc;
+    byte dep;           // load: rob tag of the store it is predicted to depend on, 0 for none
+    bool sent;          // store: result broadcast, load: access started
+    byte fwd;           // load: rob tag of the store it read from, 0 for memory
+
+    // the address is known as soon as the base register is
+    bool addr_ready() const {return !op.src1; }
+    addr_t addr() const {return op.val1 + op.imm; }
+};
+
+// split load/store queue: memory operations stay from issue to commit in program order,
+// and a load runs as soon as every older store address is known and none of them overlaps it,
+// or the youngest overlapping one holds all of its bytes and can forward them;
+// when speculating, a load only waits for the store it is predicted to depend on
+class LSQ: public Sequential< Queue<Lsq_item, 16> > {
+private:
+    bool speculate;
+    long long forwarded, bypassed, violations;
+
+    // the predicted producer of the load at `pos` has no address yet
+    bool waiting(int pos) {
+        auto &cque = this->cur_stat();
+        byte dep = cque[pos].dep;
+        if(!dep) return 0;
+        for(int j = cque.begin(); j != pos; j = cque.next(j)) {
+            if(is_store(cque[j].op.opt) && cque[j].op.ROBidx == dep && !cque[j].addr_ready()) return 1;
+        }
+        return 0;
+    }
+
+    // load `ld` forwarded from a store younger than store `st`
+    bool forwarded_after(int st, int ld) {
+        auto &cque = this->cur_stat();
+        for(int j = cque.next(st); j != ld; j = cque.next(j)) {
+            if(is_store(cque[j].op.opt) && cque[j].op.ROBidx == cque[ld].fwd) return 1;
+        }
+        return 0;
+    }
+
+    static bool overlap(const Lsq_item &a, const Lsq_item &b) {
+        return a.addr() < b.addr() + mem_width(b.op.opt) && b.addr() < a.addr() + mem_width(a.op.opt);
+    }
+    static bool covers(const Lsq_item &st, const Lsq_item &ld) {
+        return st.addr() <= ld.addr() && ld.addr() + mem_width(ld.op.opt) <= st.addr() + mem_width(st.op.opt);
+    }
+
+public:
+    LSQ(): speculate(0), forwarded(0), bypassed(0), violations(0) {}
+
+    void init(bool spec) {
+        speculate = spec;
+    }
+
+    bool full() {return this->cur_stat().full(); }
+    bool empty() {return this->cur_stat().empty(); }
+    int size() {return this->cur_stat().length(); }
+
+    void issue(const Buffer_item &item, addr_t pc, byte dep) {
+        this->nex_stat().push(Lsq_item{item, pc, dep, 0, 0});
+    }
+    const Lsq_item& operator [] (int pos) {
+        return this->cur_stat()[pos];
+    }
+
+    // the load's forwarding store is kept by rob tag, its slot is reused once it commits
+    void mark_sent(int pos, int fwd = -1) {
+        if(!this->nex_stat().inque(pos)) return ;
+        this->nex_stat()[pos].sent = 1;
+        this->nex_stat()[pos].fwd = ~fwd? this->cur_stat()[fwd].op.ROBidx: 0;
+    }
+
+    // the oldest store with its address and data, -1 for none
+    int store_ready() {
+        auto &cque = this->cur_stat();
+        for(int i = cque.begin(); i != cque.end(); i = cque.next(i)) {
+            auto &item = cque[i];
+            if(is_store(item.op.opt) && item.addr_ready() && !item.sent && !item.op.src2) return i;
+        }
+        return -1;
+    }
+
+    // the oldest load allowed to run, -1 for none; `fwd` is the store it reads from, -1 for memory
+    int load_ready(int &fwd) {
+        auto &cque = this->cur_stat();
+        bool older = 0;
+        for(int i = cque.begin(); i != cque.end(); i = cque.next(i)) {
+            auto &item = cque[i];
+            if(is_store(item.op.opt)) {
+                if(!item.addr_ready() && !speculate) return -1;
+                older = 1;
+                continue;
+            }
+            if(item.sent || !item.addr_ready() || waiting(i)) continue;
+            fwd = -1;
+            for(int j = cque.begin(); j != i; j = cque.next(j)) {
+                if(is_store(cque[j].op.opt) && cque[j].addr_ready() && overlap(cque[j], item)) fwd = j;
+            }
+            if(~fwd && (!covers(cque[fwd], item) || cque[fwd].op.src2)) continue;
+            forwarded += ~fwd? 1: 0;
+            bypassed += older;
+            return i;
+        }
+        return -1;
+    }
+    // the bytes of load `ld` taken from store `st`, zero extended
+    word forward(int st, int ld) {
+        auto &cque = this->cur_stat();
+        word val = cque[st].op.val2 >> ((cque[ld].addr() - cque[st].addr()) * 8);
+        int width = mem_width(cque[ld].op.opt);
+        return width == 4? val: val & ((1u << width * 8) - 1);
+    }
+
+    // the oldest younger load that already read what store `st` overwrites, -1 for none;
+    // a load that forwarded from a store between `st` and itself read the right value, while
+    // one that forwarded from an older store, possibly committed by now, did not
+    int violation(int st) {
+        auto &cque = this->cur_stat();
+        for(int i = cque.next(st); i != cque.end(); i = cque.next(i)) {
+            auto &item = cque[i];
+            if(!is_load(item.op.opt) || !item.sent || !overlap(cque[st], item)) continue;
+            if(item.fwd && forwarded_after(st, i)) continue;
+            violations++;
+            return i;
+        }
+        return -1;
+    }
+
+    void commit() {
+        this->nex_stat().pop();
+    }
+
+    template <typename F>
+    void squash(F younger) {
+        auto &nque = this->nex_stat();
+        for(int i = nque.begin(); i != nque.end(); i = nque.next(i)) {
+            if(younger(nque[i].op.ROBidx)) {nque.cut(i); return ; }
+        }
+    }
+
+    void update(byte idx, word data) {
+        auto &cque = this->cur_stat();
+        auto &nque = this->nex_stat();
+        for(int i = cque.begin(); i != cque.end(); i = cque.next(i)) {
+            if(cque[i].op.match(idx)) {
+                if(nque.inque(i)) nque[i].op.update(idx, data);
+            }
+        }
+    }
+
+    void flush() {
+        this->nex_stat().clear();
+    }
+
+    void print() {
+        auto cur = this->cur_stat();
+        if(cur.empty()) std::cout << "empty\n";
+        for(int i = cur.begin(); i != cur.end(); i = cur.next(i)) {
+            auto x = cur[i];
+            std::cout << "#" << std::setw(2) << std::setfill('0') << std::dec << word(x.op.ROBidx) << ' ';
+            std::cout << std::setw(5) << std::setfill(' ') << opt_to_string(x.op.opt) << ' ';
+            if(x.addr_ready()) std::cout << std::setw(8) << std::setfill('0') << std::hex << x.addr() << ' ';
+            else std::cout << "????????" << ' ';
+            std::cout << "#" << std::setw(4) << std::setfill('0') << std::dec << word(x.op.src2) << ' ';
+            std::cout << std::setw(8) << std::setfill('0') << std::hex << word(x.op.val2) << ' ';
+            std::cout << (x.sent? "sent": "wait") << '\n';
+        }
+    }
+
+    void report(std::ostream &os) {
+        os << "[lsq] loads forwarded " << forwarded << " loads passing older stores " << bypassed;
+        if(speculate) os << " ordering violations " << violations;
+        os << '\n';
+    }
+};
+
+// multi-cycle functional unit: a pipelined one accepts an operation every cycle,
+// an iterative one holds a single operation until it finishes
+class Exec_unit {
+private:
+    int latency;
+    bool pipelined;
+    long long last;
+    std::deque<std::pair<long long, CDB_msg> > que;
+
+public:
+    void init(int lat, bool pipe) {
+        latency = lat, pipelined = pipe, last = -1;
+        que.clear();
+    }
+    bool free(long long now) {
+        return pipelined? last != now: que.empty();
+    }
+    void issue(const CDB_msg &msg, long long now) {
+        que.emplace_back(now + latency - 1, msg);
+        last = now;
+    }
+    bool done(long long now) {
+        return !que.empty() && que.front().first <= now;
+    }
+    CDB_msg pop() {
+        auto msg = que.front().second;
+        que.pop_front();
+        return msg;
+    }
+    template <typename F>
+    void squash(F pred) {
+        que.erase(std::remove_if(que.begin(), que.end(), [&](const std::pair<long long, CDB_msg> &op) {
+            return pred(op.second);
+        }), que.end());
+    }
+    void flush() {
+        que.clear();
+    }
+};
+
+// register results live in the physical register file, data and addr only keep
+// what commit needs: branch outcomes, jump targets and store operands
 struct ROB_item {
     byte idx;
     inst_t org;
     RV32I_Opt opt;
     int cnt;
     word dest;
+    byte pdst;
+    bool fused;     // stands for two instructions
+    bool moved;     // eliminated move, pdst is shared with the source
+    bool replay;    // load that read stale data, refetched at the head
+    bool resolved;  // mispredicted branch already recovered when it executed
+    bool predicted; // load whose value was predicted at issue
+    word pred;
     word data;
     word addr;
     
@@ -179,28 +490,41 @@ struct ROB_item {
     addr_t nex_pc, mis_pc;
     bool jump;
 
+    long long uid;  // pipeline trace id
+    long long uid2; // and that of the second half of a fused pair
 };
 
+// entries are tagged base + 1 to base + 16, so the partitions of several threads never collide
 class ROB: public Sequential< Queue<ROB_item, 16> > {
+private:
+    byte base;
+
 public:
+    ROB(): base(0) {}
+    void init(byte tag_base) {base = tag_base; }
+
     bool empty() {return this->cur_stat().empty(); }
     bool full() {return this->cur_stat().full(); }
+    int size() {return this->cur_stat().length(); }
 
-    int allocate() {
-        return this->nex_stat().allocate();
+    // tag of the new entry
+    byte allocate() {
+        return this->nex_stat().allocate() + base + 1;
     }
+    int slot(byte idx) {return idx - 1 - base; }
 
-    bool ready(int idx) {
-        if(!this->cur_stat().inque(idx - 1)) return 0;
-        return this->cur_stat()[idx - 1].cnt == 0;
-    }
-    word value(int idx) {
-        return this->cur_stat()[idx - 1].data;
+    // physical register written by entry `idx`, 0 for none
+    byte tag(int idx) {
+        return this->cur_stat()[slot(idx)].pdst;
     }
 
     void issue(int idx, const ROB_item &item) {
-        if(!this->nex_stat().inque(idx - 1)) return ;
-        this->nex_stat()[idx - 1] = item;
+        if(!this->nex_stat().inque(slot(idx))) return ;
+        this->nex_stat()[slot(idx)] = item;
+    }
+
+    const ROB_item& front() {
+        return this->cur_stat().front();
     }
 
     const ROB_item* commit() {
@@ -213,11 +537,44 @@ public:
         return nullptr;
     }
 
+    const ROB_item& at(byte idx) {
+        return this->cur_stat()[slot(idx)];
+    }
+    // position of entry `idx` counted from the head, younger entries are further
+    int age(byte idx) {
+        return (slot(idx) - this->cur_stat().begin() + 16) % 16;
+    }
+    // drop every entry younger than `idx`, handing each to `drop` first
+    template <typename F>
+    void squash(byte idx, F drop) {
+        auto &nque = this->nex_stat();
+        for(int i = nque.next(slot(idx)); i != nque.end(); i = nque.next(i)) drop(nque[i]);
+        nque.cut(nque.next(slot(idx)));
+    }
+    template <typename F>
+    void each(F f) {
+        auto &nque = this->nex_stat();
+        for(int i = nque.begin(); i != nque.end(); i = nque.next(i)) f(nque[i]);
+    }
+    int stores() {
+        auto &nque = this->nex_stat();
+        int cnt = 0;
+        for(int i = nque.begin(); i != nque.end(); i = nque.next(i)) cnt += is_store(nque[i].opt);
+        return cnt;
+    }
+    void resolve(byte idx) {
+        if(this->nex_stat().inque(slot(idx))) this->nex_stat()[slot(idx)].resolved = 1;
+    }
+
+    void replay(byte idx) {
+        if(this->nex_stat().inque(slot(idx))) this->nex_stat()[slot(idx)].replay = 1;
+    }
+
     void update(byte idx, word data, addr_t addr) {
-        if(this->nex_stat().inque(idx - 1)) {
-            this->nex_stat()[idx - 1].cnt--;
-            this->nex_stat()[idx - 1].data = data;
-            this->nex_stat()[idx - 1].addr = addr;
+        if(this->nex_stat().inque(slot(idx))) {
+            this->nex_stat()[slot(idx)].cnt--;
+            this->nex_stat()[slot(idx)].data = data;
+            this->nex_stat()[slot(idx)].addr = addr;
         }
     }
 
@@ -230,10 +587,11 @@ public:
         if(cur.empty()) std::cout << "empty\n";
         for(int i = cur.begin(); i != cur.end(); i = cur.next(i)) {
             auto x = cur[i];
-            std::cout << "#" << std::setw(2) << std::setfill('0') << std::dec << i + 1 << ' ';
+            std::cout << "#" << std::setw(2) << std::setfill('0') << std::dec << i + 1 + base << ' ';
             std::cout << std::setw(8) << std::setfill('0') << std::hex << x.org << ' ';
             std::cout << std::setw(5) << std::setfill(' ') << opt_to_string(x.opt) << ' ';
             std::cout << "#" << std::dec << std::setw(4) << std::setfill('0') << x.dest << ' ';
+            std::cout << "p" << std::dec << std::setw(3) << std::setfill('0') << word(x.pdst) << ' ';
             std::cout << std::setw(8) << std::setfill('0') << std::hex << x.data << ' ';
             std::cout << std::setw(8) << std::setfill('0') << std::hex << x.addr << ' ';
             std::cout << '(';
@@ -251,65 +609,116 @@ struct InstQue_node {
     inst_t inst;
     addr_t pc, nex_pc, mis_pc;
     bool jump;
+    byte len;       // 2 for compressed instructions, already expanded in `inst`
+    Decoder dec;    // decoded once at fetch
+    long long uid;  // pipeline trace id
 };
 
-class Speculation {
+// loop stream detector: a backward taken branch or jump opens a capture of the next pass
+// over its body, and once the same branch closes it, fetch replays the decoded body from
+// here instead of reading and decoding memory, until the prediction leaves the loop
+class Loop_buffer {
+public:
+    struct Entry {
+        inst_t inst;
+        addr_t pc;
+        byte len;
+        Decoder dec;
+    };
+
 private:
-    const static int HASH_SIZE = 4096; 
-    byte BHT[HASH_SIZE];
-    byte BPHT[4][HASH_SIZE];
-    byte GHR;
-    byte GPHT[8][HASH_SIZE];
-    byte CPHT[8][HASH_SIZE];
+    enum State {IDLE, CAPTURE, STREAM};
+    int capacity;
+    State state;
+    addr_t start, end, expect;
+    std::vector<Entry> body;
+    int pos;
+    long long loops, replayed;
 
-    int total;
-    int correct;
+public:
+    void init(int cap) {
+        capacity = cap, state = IDLE, pos = 0;
+        loops = replayed = 0;
+        body.clear();
+    }
+    bool enabled() {return capacity > 0; }
 
-    word hash(addr_t pc) {
-        return ((pc >> 12) ^ (pc >> 2)) & 0xfff;
+    // whether the instruction at `pc` comes from the buffer
+    bool streaming(addr_t pc) {
+        if(state == STREAM && body[pos].pc != pc) state = IDLE;
+        return state == STREAM;
+    }
+    const Entry& next() {return body[pos]; }
+    // the entry just replayed was predicted to continue at `nex_pc`
+    void advance(addr_t nex_pc) {
+        replayed++;
+        pos = (pos + 1) % body.size();
+        if(body[pos].pc != nex_pc) state = IDLE;
     }
 
-    static void inc(byte &stat) {
-        if(stat < 3) stat++;
+    // watch an instruction fetched from memory, `plain` ones have no side effect on fetch
+    void observe(const Entry &e, addr_t nex_pc, bool plain) {
+        if(state == CAPTURE) {
+            bool fits = e.pc == expect && int(body.size()) < capacity;
+            if(fits && e.pc == end && nex_pc == start) {
+                body.push_back(e);
+                state = STREAM, pos = 0, loops++;
+                return ;
+            }
+            if(fits && e.pc != end && plain && nex_pc == e.pc + e.len) {
+                body.push_back(e);
+                expect = nex_pc;
+                return ;
+            }
+            state = IDLE;
+        }
+        if(state == IDLE && (e.dec.type == 'B' || e.dec.type == 'J') && nex_pc < e.pc && (e.pc - nex_pc) / 2 < addr_t(capacity)) {
+            state = CAPTURE, start = expect = nex_pc, end = e.pc;
+            body.clear();
+        }
+    }
+
+    void flush() {
+        state = IDLE;
     }
-    static void dec(byte &stat) {
-        if(stat > 0) stat--;
+
+    void report(std::ostream &os) {
+        os << "[loop buffer] " << capacity << " entries, loops captured " << loops << " instructions replayed " << replayed << '\n';
     }
+};
+
+struct Fusion_stat {
+    long long lui_addi, auipc_addi, auipc_jalr, moves;
+};
+
+struct Branch_stat {
+    long long total, miss, jump;
+};
+
+class Speculation {
+private:
+    std::unique_ptr<Predictor> bp;
+    Predictor_config cfg;
+    std::unordered_map<addr_t, Branch_stat> branch;
+
+    int total;
+    int correct;
 
 public:
-    Speculation() {
+    Speculation(const Predictor_config &config): cfg(config) {
         total = correct = 0;
-        GHR = 0;
-        memset(BHT, 0, sizeof(BHT));
-        memset(GPHT, 0, sizeof(GPHT));
-        memset(BPHT, 0, sizeof(BPHT));
-        memset(CPHT, 0, sizeof(CPHT));
+        bp = make_predictor(cfg);
     }
 
     bool predict(addr_t pc) {
-        word key = hash(pc);
-        // #1 global prediction
-        // return GPHT[GHR][key] >= 2;
-        // #2 local prediction
-        // return GPHT[BHT[key]][key] >= 2;
-        // #3 competitive predition
-        if(CPHT[GHR][key] >= 2) return GPHT[GHR][key] >= 2;
-        else return BPHT[BHT[key]][key] >= 2;
+        return bp->predict(pc);
     }
 
     void feedback(addr_t pc, bool jump, bool mis) {
         if(!mis) correct++; total++;
-        word key = hash(pc);
-        bool p1 = (GPHT[GHR][key] >= 2) == jump;
-        bool p2 = (BPHT[BHT[key]][key] >= 2) == jump;
-        if(p1 != p2) {
-            if(p1) inc(CPHT[GHR][key]);
-            if(p2) dec(CPHT[GHR][key]);
-        }
-        if(jump) inc(GPHT[GHR][key]), inc(BPHT[BHT[key]][key]);
-        else dec(GPHT[GHR][key]), dec(BPHT[BHT[key]][key]);
-        GHR = ((GHR << 1) | jump) & 7;
-        BHT[key] = ((BHT[key] << 1) | jump) & 3;
+        auto &stat = branch[pc];
+        stat.total++, stat.miss += mis, stat.jump += jump;
+        bp->update(pc, jump);
     }
 
     double accuracy() {
@@ -317,33 +726,125 @@ public:
         else return 1.0;
     }
 
+    void report(int top) {
+        std::vector<std::pair<addr_t, Branch_stat> > list(branch.begin(), branch.end());
+        std::sort(list.begin(), list.end(), [](const std::pair<addr_t, Branch_stat> &a, const std::pair<addr_t, Branch_stat> &b) {
+            return a.second.miss > b.second.miss || (a.second.miss == b.second.miss && a.first < b.first);
+        });
+        std::cerr << "[predictor] " << cfg.to_string() << ", " << branch.size() << " static branches\n";
+        for(int i = 0; i < top && i < int(list.size()); ++i) {
+            auto &stat = list[i].second;
+            std::cerr << std::hex << std::setw(8) << std::setfill('0') << list[i].first << std::dec;
+            std::cerr << " exec " << stat.total << " taken " << stat.jump << " miss " << stat.miss;
+            std::cerr << " acc " << std::setprecision(4) << 1.0 - 1.0 * stat.miss / stat.total << '\n';
+        }
+    }
+
 };
 
-class simulator {
+// one hart: a Tomasulo pipeline with private caches on top of the shared guest memory
+class Core {
 public:
     const static int REG_NUM = 32;
     const static int MEM_SIZE = 5e5;
+    const static int LOAD_FORWARDED = -2;   // load ticket when a store supplies every byte, the value is in the request
+    // region of interest markers, no-ops unless --roi is given
+    const static inst_t ROI_BEGIN = 0x00100013;     // addi x0, x0, 1
+    const static inst_t ROI_END = 0x00200013;       // addi x0, x0, 2
+
+    // events behind mhpmcounter3 and up, in counter order
+    enum Hpm_event {
+        HPM_MISPREDICT,     // committed conditional branches the predictor got wrong
+        HPM_ROB_FULL,       // cycles the thread had an instruction to issue but no rob entry
+        HPM_LOAD,           // committed loads
+        HPM_STORE,          // committed stores
+        HPM_BRANCH,         // committed conditional branches
+        HPM_EVENTS
+    };
 
 private:
+    // architectural and front-end state of one hardware thread; the threads of a core
+    // share its reservation station, store/load buffer, functional units and cdb
+    struct Thread {
+        int hartid;
+        bool halt_flag;
+        bool flush_flag;
+        addr_t jump_to;
+        int inst_num;
+        word exit_a0;           // a0 as the halt found it, the other threads keep the clock running
+
+        Register<word> pc;
+        Phys_regfile<> prf;
+        ROB rob;
+        SeqQueue<InstQue_node, 16> inst_que;
+        Stall stall;
+        Counter store_cnt;
+        Loop_buffer lsd;
+
+        bool sys_busy;          // the ecall at the rob head has run, its result is on the way
+        Syscall<MEM_SIZE>::Result sys_res;
+        int serial_ticket;
+        int fetch_ticket;
+        addr_t fetch_line, fetch_req;
+        bool fetch_valid;
+        bool fetch_split;       // first half of a line-crossing instruction is done
+
+        // early branch resolution: rename map per in-flight branch, and the recovery due at the clock edge
+        Phys_regfile<>::Checkpoint ckpt[16];
+        byte squash_idx;
+        addr_t squash_pc;
+
+        Vector_regfile vrf;
+        bool vec_started;       // the vector instruction at the rob head went into the vector unit
+
+        word fcsr;              // frm in bits 7:5, the accrued fflags below
+
+        long long hpm[HPM_EVENTS];
+        long long ctr_base[32]; // subtracted from counter n, so that writes to the m-mode counters stick
+
+        bool refill;            // flushed or squashed, and nothing issued since
+    };
+    // the instruction in the vector unit: its effect on registers and memory is made when it
+    // starts, then the unit stays busy until every data cache line it touches was accessed
+    // and every element group went through the lanes
+    struct Vector_job {
+        bool busy;
+        byte idx;
+        word res;               // scalar result, broadcast when done
+        long long done;         // cycle the last element group leaves
+        std::vector<addr_t> lines;
+        size_t next;
+        bool write;
+        int ticket;
+    };
+    const static int MAX_THREADS = 2;
+
+    Config cfg;
+    int coreid;
     bool halt_flag;
-    bool flush_flag;
-    addr_t jump_to;
     long long cycle;
-    int inst_num;
 
-    Register<word> pc;
-    Regfile<REG_NUM> regfile;
+    Thread thr[MAX_THREADS];
+    int threads;
+    Thread *t;              // the thread the current stage works for
+    int fetch_rr, issue_rr, commit_rr;
 
     Decoder decoder;
     Bus<CDB_msg> cdb;
 
-    RAM<MEM_SIZE> ram; 
-    Delay<CDB_msg, 3> load_delay;
-    Delay<Store_msg, 3> store_delay; 
+    RAM<MEM_SIZE> &ram; 
+    Syscall<MEM_SIZE> &sys;
+    std::vector<std::unique_ptr<Memory_level> > mem_levels;
+    Cache *icache;
+    Stride_prefetcher *prefetcher;      // between the L1D and the level below, null when off
+    Memory_level *dmem;
+    bool load_busy;
+    Mem_req load_req;
+    Store_buffer<MEM_SIZE> store_buf;   // committed stores not yet written to memory
     
     Speculation spec;
-
-    SeqQueue<InstQue_node, 16> inst_que;
+    Branch_trace_writer btrace;
+    Fusion_stat fusion;
 
     ALU alu;
     Adder addr_adder;
@@ -351,64 +852,278 @@ private:
     CDB_reg store_out;
     // CDB_reg addrout;
     CDB_reg load_out;
-    Stall stall;
-
-    SeqQueue<CDB_reg*, 5> send_que;
+    Exec_unit mul_unit, div_unit;
+    CDB_reg mul_out, div_out;
+    CDB_reg sys_out;
+    Vector_alu valu;
+    Vector_job vjob;
+    std::vector<byte> vbuf;     // a scalar operand broadcast to every element
+    CDB_reg vec_out;
+    long long vec_insts, vec_elems, vec_busy;
+    FPU fpu;
+    Exec_unit fp_unit, fdiv_unit;
+    CDB_reg fp_out, fdiv_out;
+
+    SeqQueue<CDB_reg*, 16> send_que;
+
+    long long squashes;
+
+    Pipeline_stats stats;
+    Kanata_writer ktrace;
+    Commit_trace_writer ctrace;
+    Stall_reason blocked;   // why the last thread-level issue or commit did nothing
+    Cpi_slot lost;          // where commit's slot went in that case
+
+    // with --roi the core executes functionally until a begin marker, in detail up to the
+    // end marker, then drains its store buffer and goes back to executing functionally
+    bool detailed, roi_leaving;
+    int roi_count;
+    long long ff_insts, ff_cycles;      // spent outside the regions, left out of the report
+    long long roi_insts, roi_cycles, roi_misses;    // as the current region began
 
     RS rs;
     SLB slb;
-    ROB rob;
-    Counter store_cnt;
+    LSQ lsq;            // replaces the slb with --lsq
+    Store_set ssets;
+    std::unique_ptr<Value_predictor> vp;    // load value prediction, null when off
+
+    // rob entries of thread i are tagged 16 * i + 1 to 16 * i + 16
+    Thread& owner(byte idx) {return thr[(idx - 1) / 16]; }
+    ROB& rob_of(byte idx) {return owner(idx).rob; }
+    void use(int id) {t = &thr[id]; }
+
+    // the fetch unit buffers one instruction cache line at a time
+    bool fetch_line_ready(addr_t cur_pc) {
+        addr_t line = cur_pc / icache->line_size();
+        if(t->fetch_ticket >= 0) {
+            if(!icache->ready(t->fetch_ticket)) return 0;
+            icache->release(t->fetch_ticket), t->fetch_ticket = -1;
+            t->fetch_line = t->fetch_req, t->fetch_valid = 1;
+        }
+        if(t->fetch_valid && t->fetch_line == line) return 1;
+        t->fetch_ticket = icache->request(cur_pc, 0);
+        t->fetch_req = line;
+        return 0;
+    }
+
+    // memory as seen by loads, including committed stores still on their way
+    byte load_byte(addr_t addr) {
+        return store_buf.read(addr);
+    }
+    word load_value(RV32I_Opt opt, addr_t addr) {
+        word val = 0;
+        for(int i = mem_width(opt) - 1; i >= 0; --i) val = val << 8 | load_byte(addr + i);
+        return extend(opt, val);
+    }
+    static word extend(RV32I_Opt opt, word val) {
+        switch(opt) {
+            case LB: return Decoder::sext(val, 8);
+            case LH: return Decoder::sext(val, 16);
+            default: return val;
+        }
+    }
+
+    // atomics, fences and csr accesses run at the head of the rob once older stores have drained
+    static bool serial(RV32I_Opt opt) {
+        return (opt > AMO_BEG && opt < AMO_END) || (opt > SYS_BEG && opt < SYS_END && opt != ECALL);
+    }
+
+    // raw value of counter n: cycle, time, instret, then the events
+    long long counter(int n) {
+        if(n < 2) return cycle;
+        if(n == 2) return t->inst_num;
+        return n - 3 < HPM_EVENTS? t->hpm[n - 3]: 0;
+    }
+
+    word read_csr(word csr) {
+        // cycle, time, instret and hpmcounter3-31 with their high halves, and the m-mode aliases
+        if((csr >= 0xc00 && csr < 0xca0) || (csr >= 0xb00 && csr < 0xba0)) {
+            long long val = counter(csr & 31) - t->ctr_base[csr & 31];
+            return csr & 0x80? word(val >> 32): word(val);
+        }
+        // the events are wired, mhpmevent reads which one a counter counts
+        if(csr >= 0x323 && csr < 0x340) return (csr & 31) - 3 < HPM_EVENTS? (csr & 31) - 2: 0;
+        switch(csr) {
+            case 0x001: return t->fcsr & 31;
+            case 0x002: return t->fcsr >> 5 & 7;
+            case 0x003: return t->fcsr;
+            case 0xf14: return t->hartid;
+            default: return 0;
+        }
+    }
+    void write_csr(word csr, word data) {
+        if(csr >= 0xb00 && csr < 0xba0 && (csr & 31) != 1) {
+            int n = csr & 31;
+            unsigned long long val = counter(n) - t->ctr_base[n];
+            if(csr & 0x80) val = (val & 0xffffffffull) | (unsigned long long)data << 32;
+            else val = (val & ~0xffffffffull) | data;
+            // the write wins over the writing instruction's own retirement
+            t->ctr_base[n] = counter(n) + (n == 2) - val;
+            return ;
+        }
+        switch(csr) {
+            case 0x001: t->fcsr = (t->fcsr & ~31u) | (data & 31); break;
+            case 0x002: t->fcsr = (t->fcsr & 31) | (data & 7) << 5; break;
+            case 0x003: t->fcsr = data & 0xff; break;
+        }
+    }
+
+    word serial_exec(inst_t org) {
+        Decoder dec;
+        dec.decode(org);
+        word val1 = t->prf.arch_read(dec.rs1);
+        word val2 = t->prf.arch_read(dec.rs2);
+        switch(dec.opt) {
+            case LR_W: return ram.load_reserved(t->hartid, val1);
+            case SC_W: return !ram.store_conditional(t->hartid, val1, val2);
+            case AMOSWAP_W: return ram.atomic_update(val1, [&](word old) {return val2; });
+            case AMOADD_W: return ram.atomic_update(val1, [&](word old) {return old + val2; });
+            case AMOXOR_W: return ram.atomic_update(val1, [&](word old) {return old ^ val2; });
+            case AMOAND_W: return ram.atomic_update(val1, [&](word old) {return old & val2; });
+            case AMOOR_W: return ram.atomic_update(val1, [&](word old) {return old | val2; });
+            case AMOMIN_W: return ram.atomic_update(val1, [&](word old) {return signed(old) < signed(val2)? old: val2; });
+            case AMOMAX_W: return ram.atomic_update(val1, [&](word old) {return signed(old) > signed(val2)? old: val2; });
+            case AMOMINU_W: return ram.atomic_update(val1, [&](word old) {return old < val2? old: val2; });
+            case AMOMAXU_W: return ram.atomic_update(val1, [&](word old) {return old > val2? old: val2; });
+            case CSRRW: case CSRRS: case CSRRC:
+            case CSRRWI: case CSRRSI: case CSRRCI: {
+                word csr = dec.imm & 0xfff;
+                word src = dec.opt >= CSRRWI? word(dec.rs1): val1;
+                word old = read_csr(csr);
+                switch(dec.opt) {
+                    case CSRRW: case CSRRWI: write_csr(csr, src); break;
+                    case CSRRS: case CSRRSI: if(dec.rs1) write_csr(csr, old | src); break;
+                    case CSRRC: case CSRRCI: if(dec.rs1) write_csr(csr, old & ~src); break;
+                }
+                return old;
+            }
+            default: return 0;
+        }
+    }
 
+    // instructions of thread `id` before execution, what ICOUNT fetch gives priority by
+    int icount(int id) {
+        auto mine = [&](byte idx) {return (idx - 1) / 16 == id; };
+        return thr[id].inst_que.size() + rs.count(mine) + slb.count(mine);
+    }
+
+    // one thread fetches per cycle: the next one in turn, or with ICOUNT the one with
+    // the fewest instructions waiting to execute
     void fetch() {
-        if(inst_que.full() || stall.get()) return ;
-        addr_t cur_pc = pc.read();
+        int pick = -1, best = 0;
+        for(int k = 0; k < threads; ++k) {
+            int i = (fetch_rr + k) % threads;
+            if(thr[i].halt_flag || thr[i].inst_que.full() || thr[i].stall.get()) continue;
+            int cnt = threads > 1 && cfg.fetch_policy == "icount"? icount(i): 0;
+            if(pick < 0 || cnt < best) pick = i, best = cnt;
+        }
+        if(pick < 0) {
+            for(int i = 0; i < threads; ++i) {
+                if(thr[i].halt_flag) continue;
+                stats.stall(thr[i].inst_que.full()? FETCH_QUEUE_FULL: FETCH_STALLED);
+                break;
+            }
+            return ;
+        }
+        fetch_rr = (pick + 1) % threads;
+        use(pick);
+        fetch_thread();
+    }
+
+    void fetch_thread() {
+        if(t->inst_que.full() || t->stall.get()) return ;
+        addr_t cur_pc = t->pc.read();
+        if(t->lsd.streaming(cur_pc)) {
+            auto first = t->lsd.next();
+            addr_t nex_pc = fetch_one(first.inst, cur_pc, first.len, first.dec);
+            t->lsd.advance(nex_pc);
+            if(!cfg.fusion || !t->lsd.streaming(nex_pc) || t->inst_que.size() + 2 > t->inst_que.capacity()) return ;
+            auto second = t->lsd.next();
+            if(fusable(first.dec, second.dec)) t->lsd.advance(fetch_one(second.inst, nex_pc, second.len, second.dec));
+            return ;
+        }
         inst_t inst = ram.read_word(cur_pc);
-        // halt instruction
-        if(inst == 0x0ff00513) stall.set(1);
-        
+        byte len = Decoder::compressed(inst)? 2: 4;
+        if(icache) {
+            // an instruction crossing a line boundary needs both lines
+            bool split = cur_pc / icache->line_size() != (cur_pc + len - 1) / icache->line_size();
+            if(!fetch_line_ready(t->fetch_split? cur_pc + 2: cur_pc)) return stats.stall(FETCH_ICACHE);
+            if(split && !t->fetch_split) {
+                t->fetch_split = 1;
+                if(!fetch_line_ready(cur_pc + 2)) return stats.stall(FETCH_ICACHE);
+            }
+            t->fetch_split = 0;
+        }
+        if(len == 2) inst = Decoder::expand(inst & 0xffff);
         Decoder pre_decoder;
-        Adder pc_adder;
         pre_decoder.decode(inst);
-        if(pre_decoder.opt == JALR) stall.set(1);
+        addr_t nex_pc = fetch_one(inst, cur_pc, len, pre_decoder);
+        if(t->lsd.enabled()) t->lsd.observe(Loop_buffer::Entry{inst, cur_pc, len, pre_decoder}, nex_pc, plain(pre_decoder));
+
+        // a fusable pair within the current line is fetched as one, so issue finds both halves
+        if(!cfg.fusion || pre_decoder.opt != LUI && pre_decoder.opt != AUIPC) return ;
+        if(t->inst_que.size() + 2 > t->inst_que.capacity()) return ;
+        inst_t second = ram.read_word(nex_pc);
+        byte second_len = Decoder::compressed(second)? 2: 4;
+        if(icache && cur_pc / icache->line_size() != (nex_pc + second_len - 1) / icache->line_size()) return ;
+        if(second_len == 2) second = Decoder::expand(second & 0xffff);
+        Decoder dec;
+        dec.decode(second);
+        if(!fusable(pre_decoder, dec)) return ;
+        addr_t after = fetch_one(second, nex_pc, second_len, dec);
+        if(t->lsd.enabled()) t->lsd.observe(Loop_buffer::Entry{second, nex_pc, second_len, dec}, after, plain(dec));
+    }
+
+    // instructions that fetch can replay from the loop buffer without looking at them
+    static bool plain(const Decoder &dec) {
+        if(dec.org == 0x0ff00513 || dec.opt == NONE) return 0;
+        return dec.type != 'J' && dec.opt != JALR && dec.opt != ECALL && !serial(dec.opt) && !is_vstore(dec.opt);
+    }
+
+    // predict the successor of an instruction and queue it, returns the predicted next pc
+    addr_t fetch_one(inst_t inst, addr_t cur_pc, byte len, const Decoder &pre_decoder) {
+        Adder pc_adder;
+        // halt instruction
+        if(inst == 0x0ff00513) t->stall.set(1);
+        if(pre_decoder.opt == JALR || serial(pre_decoder.opt)) t->stall.set(1);
+        // nothing younger may read memory before a vector store wrote it
+        if(cfg.use_vector && is_vstore(pre_decoder.opt)) t->stall.set(1);
 
 // std::cout << ">> fetch inst: " << std::hex << std::setw(8) << std::setfill('0') << word(inst) << " ";
 // std::cout << std::setw(5) << std::setfill(' ') << opt_to_string(pre_decoder.opt) << " ";
 // std::cout << std::hex << std::setw(8) << std::setfill('0') << word(pre_decoder.imm) << "\n";
 
         // predict next pc
-        bool flag = 0;
-        if(pre_decoder.type == 'B') flag = spec.predict(cur_pc);
-        if(pre_decoder.type == 'J') flag = 1;
-        addr_t nex_pc = pc_adder.calc(cur_pc, flag? pre_decoder.imm: 4);
+        bool pred = pre_decoder.type == 'B' && spec.predict(cur_pc);
+        bool flag = pred || pre_decoder.type == 'J';
+        addr_t nex_pc = pc_adder.calc(cur_pc, flag? pre_decoder.imm: len);
         // pc when mispredicted
-        flag = 0;
-        if(pre_decoder.type == 'B') flag = !spec.predict(cur_pc);
-        if(pre_decoder.type == 'J') flag = 1;
-        addr_t mis_pc = pc_adder.calc(cur_pc, flag? pre_decoder.imm: 4);
+        flag = (pre_decoder.type == 'B' && !pred) || pre_decoder.type == 'J';
+        addr_t mis_pc = pc_adder.calc(cur_pc, flag? pre_decoder.imm: len);
 
 // std::cout << "cur_pc: " << std::hex << std::setw(6) << std::setfill('0') << word(cur_pc) << std::endl;
 // std::cout << "nex_pc: " << std::hex << std::setw(6) << std::setfill('0') << word(nex_pc) << std::endl;
 // std::cout << "mis_pc: " << std::hex << std::setw(6) << std::setfill('0') << word(mis_pc) << std::endl;
-        pc.write(nex_pc);
-        inst_que.push((InstQue_node) {
-            inst, cur_pc, nex_pc, mis_pc, spec.predict(cur_pc)
+        t->pc.write(nex_pc);
+        long long uid = ktrace.opened()? ktrace.fetch(cycle, t - thr, cur_pc, inst, opt_to_string(pre_decoder.opt).c_str()): 0;
+        t->inst_que.push((InstQue_node) {
+            inst, cur_pc, nex_pc, mis_pc, pred, len, pre_decoder, uid
         });
+        return nex_pc;
     }
 
     void getRegSrc(byte rs, byte &src, word &val) {
-        auto ord = regfile.order(rs);
-        if(!ord) src = 0, val = regfile.read(rs);
-        else if(rob.ready(ord)) src = 0, val = rob.value(ord);
-        else src = ord, val = 0;
+        auto tag = t->prf.lookup(rs);
+        if(t->prf.ready(tag)) src = 0, val = t->prf.read(tag);
+        else src = tag, val = 0;
     }
 
     Buffer_item getBuffer(const InstQue_node &pc_info, byte ROBidx) {
         Buffer_item ret;
         ret.ROBidx = ROBidx;
         ret.opt = decoder.opt;
-        ret.src1 = ret.src2 = 0;
-        ret.val1 = ret.val2 = 0;
+        ret.src1 = ret.src2 = ret.src3 = 0;
+        ret.val1 = ret.val2 = ret.val3 = 0;
         ret.imm = 0;
         switch(decoder.type) {
             case 'R': case 'B':
@@ -423,7 +1138,7 @@ private:
                 break;
             case 'J':
                 ret.src1 = ret.src2 = 0;
-                ret.val1 = pc_info.pc, ret.val2 = 4;
+                ret.val1 = pc_info.pc, ret.val2 = pc_info.len;
                 break;
             case 'I':
                 getRegSrc(decoder.rs1, ret.src1, ret.val1);
@@ -436,6 +1151,11 @@ private:
                 ret.imm = decoder.imm;
                 break;
         }
+        if(is_fp(decoder.opt)) {
+            if(is_fma(decoder.opt)) getRegSrc(decoder.rs3, ret.src3, ret.val3);
+            // a dynamic rounding mode is read here, fetch stops behind any csr write that could change it
+            ret.imm = decoder.funct3 == 0x7? t->fcsr >> 5: decoder.funct3;
+        }
         return ret;
     }
 
@@ -448,61 +1168,456 @@ private:
         ret.nex_pc = pc_info.nex_pc;
         ret.mis_pc = pc_info.mis_pc;
         ret.jump = pc_info.jump;
-        ret.dest = 0;
+        ret.uid = pc_info.uid;
+        ret.dest = writes_rd()? decoder.rd: 0;
+        ret.fused = 0;
+        ret.replay = 0;
+        ret.resolved = 0;
+        ret.predicted = 0;
+        ret.pred = 0;
+        ret.moved = cfg.fusion && ret.dest && move_source() >= 0;
+        if(ret.moved) ret.pdst = t->prf.share(ret.dest, move_source());
+        else ret.pdst = t->prf.rename(ret.dest);
         ret.data = 0;
         ret.addr = 0;
-        switch(decoder.type) {
-            case 'B': case 'S': break;
-            case 'R': case 'J': case 'U': case 'I':
-                ret.dest = decoder.rd;
-                regfile.rename(decoder.rd, idx);
-                break;
-        }
         ret.cnt = 1;
         // if(decoder.opt > LOAD_BEG && decoder.opt < LOAD_END) ret.cnt = 2;
         // else ret.cnt = 1;
         return ret;
     }
 
+    // source register of `addi rd, rs, 0` or `add rd, rs, x0` (c.mv), -1 otherwise
+    int move_source() {
+        if(decoder.opt == ADDI && decoder.imm == 0) return decoder.rs1;
+        if(decoder.opt == ADD && (decoder.rs1 == 0 || decoder.rs2 == 0)) return decoder.rs1 | decoder.rs2;
+        return -1;
+    }
+
+    // lui/auipc + addi on the same register, or auipc + jalr through the same register
+    static bool fusable(const Decoder &first, const Decoder &second) {
+        if(first.opt != LUI && first.opt != AUIPC) return 0;
+        if(!first.rd || second.rs1 != first.rd || second.rd != first.rd) return 0;
+        return second.opt == ADDI || (second.opt == JALR && first.opt == AUIPC);
+    }
+
+    // merge the head of the instruction queue with the next instruction into one op:
+    // lui/auipc + addi on the same register fold the immediates, and auipc + jalr through
+    // the same register becomes a direct jump whose target is known right here
+    bool fuse(InstQue_node &node) {
+        if(t->inst_que.size() < 2) return 0;
+        auto next = t->inst_que.peek(1);
+        if(next.pc != node.pc + node.len) return 0;
+        auto &dec = next.dec;
+        if(!fusable(decoder, dec)) return 0;
+        if(dec.opt == ADDI) {
+            decoder.imm += dec.imm;
+            (decoder.opt == LUI? fusion.lui_addi: fusion.auipc_addi)++;
+            return 1;
+        }
+        else {
+            // fetch stopped behind the jalr, restart it at the target
+            t->pc.write((node.pc + decoder.imm + dec.imm) & ~1u);
+            t->stall.set(0);
+            decoder.opt = JAL, decoder.type = 'J';
+            node = next;
+            fusion.auipc_jalr++;
+            return 1;
+        }
+    }
+
+    // scalar register a vector instruction writes, 0 for none
+    int vector_rd() {
+        switch(decoder.opt) {
+            case VSETVLI: case VSETIVLI: case VSETVL: case VMV_X_S: return decoder.rd;
+            default: return 0;
+        }
+    }
+
+    bool writes_rd() {
+        switch(decoder.type) {
+            case 'R': case 'J': case 'U': case 'I': return 1;
+            default: return 0;
+        }
+    }
+
+    // the instruction in rob entry `idx` enters `stage` in the pipeline trace
+    void trace(byte idx, const char *stage) {
+        if(ktrace.opened()) ktrace.stage(cycle, rob_of(idx).at(idx).uid, stage);
+    }
+
+    // one instruction of `t` in the commit trace, with the memory access of loads and stores
+    void trace_commit(addr_t pc, inst_t org, int rd, word value, RV32I_Opt opt = NONE, addr_t addr = 0, word data = 0) {
+        Commit_record rec = {pc, org, rd? value: 0, 0, 0, byte(t - thr), byte(rd), 0, 0};
+        if(is_load(opt) || is_store(opt)) {
+            rec.mem = is_load(opt)? 1: 2;
+            rec.size = mem_width(opt);
+            rec.addr = addr;
+            if(rec.mem == 2) rec.data = rec.size == 4? data: data & ((1u << 8 * rec.size) - 1);
+        }
+        ctrace.record(rec);
+    }
+
+    // a fused op keeps the encoding of its lui/auipc, and the pc of the addi's first half or of the jalr
+    void trace_commit(const ROB_item &item, word value) {
+        if(!item.fused) return trace_commit(item.cur_pc, item.org, item.dest, value, item.opt, item.addr, item.data);
+        addr_t pc = item.opt == JAL? item.cur_pc - 4: item.cur_pc;
+        addr_t pc2 = item.opt == JAL? item.cur_pc: item.nex_pc;
+        word upper = item.org & 0xfffff000;
+        inst_t second = ram.read_word(pc2);
+        if(Decoder::compressed(second)) second = Decoder::expand(second & 0xffff);
+        trace_commit(pc, item.org, item.dest, item.opt == LUI? upper: pc + upper);
+        trace_commit(pc2, second, item.dest, value);
+    }
+
+    void trace_flush(const ROB_item &item) {
+        ktrace.flush(cycle, item.uid);
+        if(item.fused) ktrace.flush(cycle, item.uid2);
+    }
+
+    // note why the current thread's stage stopped, returns 0 for the caller to pass on
+    int block(Stall_reason why, Cpi_slot slot = CPI_CORE) {
+        blocked = why, lost = slot;
+        return 0;
+    }
+
+    // the threads take turns to issue, one that cannot passes the slot on
     void issue() {
-        if(inst_que.empty() || rob.full()) return ;
+        int first = -1;
+        Stall_reason why = ISSUE_EMPTY;
+        for(int k = 0; k < threads; ++k) {
+            int i = (issue_rr + k) % threads;
+            if(thr[i].halt_flag) continue;
+            use(i);
+            if(!issue_thread()) {
+                if(first < 0) first = i, why = blocked;
+                continue;
+            }
+            issue_rr = (i + 1) % threads;
+            return ;
+        }
+        if(first >= 0) stats.stall(why);
+    }
+
+    // returns whether an instruction left the instruction queue
+    bool issue_thread() {
+        if(t->inst_que.empty()) return block(ISSUE_EMPTY);
+        if(t->rob.full()) {
+            t->hpm[HPM_ROB_FULL]++;
+            return block(ISSUE_ROB_FULL);
+        }
 
-        auto cur_inst = inst_que.front();
+        auto cur_inst = t->inst_que.front();
 // std::cout << ">> issue inst: ";
 // std::cout << std::hex << std::setw(8) << std::setfill('0') << word(cur_inst.inst) << " ";
 // std::cout << std::hex << std::setw(8) << std::setfill('0') << word(cur_inst.pc) << " ";
 // std::cout << std::hex << std::setw(8) << std::setfill('0') << word(cur_inst.nex_pc) << " ";
 // std::cout << std::hex << std::setw(8) << std::setfill('0') << word(cur_inst.mis_pc) << "\n";
 
-        decoder.decode(cur_inst.inst);
+        decoder = cur_inst.dec;
 
-        bool sltag = 0;
-        sltag |= decoder.opt > LOAD_BEG && decoder.opt < LOAD_END;
-        sltag |= decoder.opt > STORE_BEG && decoder.opt < STORE_END;
-        if(sltag && slb.full()) return ;
-        if(!sltag && rs.full()) return ;
+        bool sltag = is_load(decoder.opt) || is_store(decoder.opt);
+        if(sltag && (cfg.lsq? lsq.full(): slb.full())) return block(ISSUE_SLB_FULL);
+        if(!sltag && rs.full()) return block(ISSUE_RS_FULL);
+        if(((writes_rd() && decoder.rd) || decoder.opt == ECALL || vector_rd()) && !t->prf.free_count()) return block(ISSUE_NO_REG);
         
-        inst_que.pop();
-        if(decoder.opt == NONE) return ;
+        t->inst_que.pop();
+        t->refill = 0;
+        if(decoder.opt == NONE || (is_vector(decoder.opt) && !cfg.use_vector)) {
+            if(ktrace.opened()) ktrace.note(cur_inst.uid, "dropped"), ktrace.flush(cycle, cur_inst.uid);
+            return 1;
+        }
+        // a fused op needs the same resources as its first instruction
+        long long first_uid = cur_inst.uid, partner = 0;
+        bool fused = cfg.fusion && fuse(cur_inst);
+        if(fused) {
+            t->inst_que.pop();
+            // the half that does not carry on shares the op's trace from here
+            partner = cur_inst.uid == first_uid? t->inst_que.peek(1).uid: first_uid;
+            if(ktrace.opened()) ktrace.note(partner, "fused"), ktrace.stage(cycle, partner, "Is");
+        }
+        if(ktrace.opened()) ktrace.stage(cycle, cur_inst.uid, "Is");
 
-        byte ROBidx = rob.allocate() + 1;
-        auto item = getBuffer(cur_inst, ROBidx);
+        byte ROBidx = t->rob.allocate();
         auto ROBitem = getROB(cur_inst, ROBidx);
+        ROBitem.fused = fused;
+        ROBitem.uid2 = partner;
+        if(ROBitem.moved) {
+            fusion.moves++;
+            ROBitem.cnt = 0;
+            t->rob.issue(ROBidx, ROBitem);
+            return 1;
+        }
+        if(serial(decoder.opt)) {
+            ROBitem.cnt = 0;
+            t->rob.issue(ROBidx, ROBitem);
+            return 1;
+        }
+        if(is_vector(decoder.opt)) {
+            // runs in the vector unit from the rob head, a scalar result comes back over the cdb
+            ROBitem.dest = vector_rd();
+            ROBitem.pdst = t->prf.rename(ROBitem.dest);
+            t->rob.issue(ROBidx, ROBitem);
+            return 1;
+        }
+        if(decoder.opt == ECALL) {
+            // fetch goes on past an ecall, its result in a0 is broadcast like any other
+            ROBitem.dest = 10;
+            ROBitem.pdst = t->prf.rename(10);
+            t->rob.issue(ROBidx, ROBitem);
+            return 1;
+        }
+        auto item = getBuffer(cur_inst, ROBidx);
         
         if(cdb.traffic()) {
             auto msg = cdb.recv();
-            item.update(std::get<0>(msg), std::get<1>(msg));            
+            auto tag = rob_of(std::get<0>(msg)).tag(std::get<0>(msg));
+            if(tag) item.update(tag, std::get<1>(msg));
         }
 
-        rob.issue(ROBidx, ROBitem);
-        if(sltag) slb.issue(item);
+        if(vp && is_load(decoder.opt) && vp->predict(cur_inst.pc, ROBitem.pred) && ROBitem.pdst) {
+            // dependents read the predicted value right away, a wrong one is squashed from here
+            ROBitem.predicted = 1;
+            t->prf.write(ROBitem.pdst, ROBitem.pred);
+            t->ckpt[t->rob.slot(ROBidx)] = t->prf.checkpoint();
+        }
+        t->rob.issue(ROBidx, ROBitem);
+        if(cfg.early_resolve && is_branch(decoder.opt)) t->ckpt[t->rob.slot(ROBidx)] = t->prf.checkpoint();
+        if(sltag && cfg.lsq) {
+            byte dep = cfg.store_sets? ssets.dispatch(cur_inst.pc, is_store(decoder.opt), ROBidx): 0;
+            lsq.issue(item, cur_inst.pc, dep);
+        }
+        else if(sltag) slb.issue(item);
         else rs.issue(item);
+        return 1;
+    }
+
+    static bool is_mul(RV32I_Opt opt) {return opt >= MUL && opt <= MULHU; }
+    static bool is_div(RV32I_Opt opt) {return opt >= DIV && opt <= REMU; }
+    // fused multiply-adds, add, sub, mul and conversions go to the pipelined fp unit, division
+    // and square root to the iterative one, the bit-level operations to the alu
+    static bool is_fpu(RV32I_Opt opt) {
+        return is_fma(opt) || (opt >= FADD_S && opt <= FMUL_S) || opt == FCVT_W_S || opt == FCVT_WU_S || opt == FCVT_S_W || opt == FCVT_S_WU;
+    }
+    static bool is_fdiv(RV32I_Opt opt) {return opt == FDIV_S || opt == FSQRT_S; }
+
+    // a floating point result, the fflags it raised travel in the address field
+    CDB_msg fp_calc(const Buffer_item &item) {
+        word flags = 0;
+        word res = fpu.calc(item.opt, item.val1, item.val2, item.val3, item.imm, flags);
+        return CDB_msg(item.ROBidx, res, flags);
+    }
+
+    // results of the multiplier and divider leave through their own cdb ports
+    void finish(Exec_unit &unit, CDB_reg &out) {
+        if(out.pending() || !unit.done(cycle)) return ;
+        out.write(unit.pop());
+        out.pend(1);
+        send_que.push(&out);
+    }
+
+    static bool branch_taken(RV32I_Opt opt, word res) {
+        switch(opt) {
+            case BEQ: case BGE: case BGEU: return res == 0;
+            case BNE: return res != 0;
+            case BLT: case BLTU: return res == 1;
+            default: return 0;
+        }
+    }
+
+    // a branch redirects fetch as soon as the alu has its outcome instead of at commit
+    void resolve(const Buffer_item &item, word res) {
+        auto &th = owner(item.ROBidx);
+        if(item.opt == JALR) {
+            th.pc.write(res & ~1u);
+            th.stall.set(0);
+            return ;
+        }
+        if(!is_branch(item.opt)) return ;
+        auto &entry = th.rob.at(item.ROBidx);
+        if(branch_taken(item.opt, res) == entry.jump) return ;
+        request_squash(th, item.ROBidx, entry.mis_pc);
+    }
+
+    // the oldest request of a cycle wins
+    void request_squash(Thread &th, byte idx, addr_t target) {
+        if(th.squash_idx && th.rob.age(th.squash_idx) < th.rob.age(idx)) return ;
+        th.squash_idx = idx;
+        th.squash_pc = target;
+    }
+
+    // take the operations `gone` selects out of the shared back end
+    template <typename F>
+    void drop(F gone) {
+        auto gone_msg = [&](const CDB_msg &msg) {return gone(std::get<0>(msg)); };
+        rs.squash(gone), slb.squash(gone), lsq.squash(gone);
+        send_que.remove_if([&](CDB_reg *out) {return out->cancel_if(gone_msg); });
+        cdb.cancel_if(gone_msg);
+        mul_unit.squash(gone_msg), div_unit.squash(gone_msg);
+        fp_unit.squash(gone_msg), fdiv_unit.squash(gone_msg);
+        if(vjob.busy && gone(vjob.idx)) abort_vector();
+        if(load_busy && gone(load_req.ROBidx)) {
+            if(load_req.ticket >= 0) dmem->release(load_req.ticket);
+            load_busy = 0;
+            load_out.flush();
+        }
+    }
+
+    // drop everything younger than a mispredicted branch or load value and roll renaming back to its checkpoint
+    void squash() {
+        byte br = t->squash_idx;
+        int age = t->rob.age(br);
+        auto mine = [&](byte idx) {return &owner(idx) == t; };
+        auto younger = [&](byte idx) {return mine(idx) && t->rob.age(idx) > age; };
+        t->rob.squash(br, [&](const ROB_item &item) {
+            if(item.moved) t->prf.release(item.pdst);
+            if(vp && is_load(item.opt)) vp->cancel(item.cur_pc);
+            if(ktrace.opened()) trace_flush(item);
+        });
+        if(ktrace.opened()) t->inst_que.each([&](const InstQue_node &node) {ktrace.flush(cycle, node.uid); });
+        t->rob.resolve(br);
+        t->prf.restore(t->ckpt[t->rob.slot(br)]);
+        drop(younger);
+        if(!cfg.lsq) t->store_cnt.set(t->rob.stores() - slb.stores(mine));
+        ssets.flush();
+        t->inst_que.flush();
+        t->lsd.flush();
+        if(t->fetch_ticket >= 0) icache->release(t->fetch_ticket), t->fetch_ticket = -1;
+        t->fetch_split = 0;
+        t->pc.write(t->squash_pc);
+        t->stall.set(0);
+        t->squash_idx = 0;
+        t->refill = 1;
+        stats.stall(FETCH_FLUSH);
+        squashes++;
+    }
+
+    void abort_vector() {
+        if(vjob.ticket >= 0) dmem->release(vjob.ticket);
+        vjob.busy = 0;
+    }
+
+    // run the vector instruction at the head of `t`'s rob
+    void start_vector(const ROB_item &head) {
+        Decoder dec;
+        dec.decode(head.org);
+        auto &v = t->vrf;
+        word val1 = t->prf.arch_read(dec.rs1), val2 = t->prf.arch_read(dec.rs2);
+        vjob = Vector_job{1, head.idx, 0, cycle, {}, 0, is_vstore(dec.opt), -1};
+        int sew = v.sew, n = v.vl;
+        if(dec.opt == VSETVLI || dec.opt == VSETIVLI || dec.opt == VSETVL) {
+            word avl = dec.opt == VSETIVLI? word(dec.rs1): dec.rs1? val1: dec.rd? ~0u: v.vl;
+            vjob.res = v.configure(avl, dec.opt == VSETVL? val2: word(dec.imm));
+            return ;
+        }
+        vec_insts++;
+        // an illegal vtype, or memory elements of another width than sew, leave everything as it was
+        if(!sew || ((is_vload(dec.opt) || is_vstore(dec.opt)) && Decoder::vector_eew(dec.funct3) != sew)) return ;
+        vec_elems += n;
+        if(is_vload(dec.opt) || is_vstore(dec.opt)) {
+            // element bytes go through load_byte, so committed stores still buffered are seen
+            addr_t line = cfg.use_l1d? cfg.l1d.line: 64;
+            word stride = dec.opt == VLSE || dec.opt == VSSE? val2: sew / 8;
+            byte *reg = v.reg(dec.rd);
+            for(int i = 0; i < n; ++i) {
+                addr_t addr = val1 + i * stride;
+                for(int j = 0; j < sew / 8; ++j) {
+                    if(vjob.write) ram.write_byte(addr + j, reg[i * sew / 8 + j]);
+                    else reg[i * sew / 8 + j] = load_byte(addr + j);
+                }
+                for(addr_t a: {addr / line, (addr + sew / 8 - 1) / line}) {
+                    if(vjob.lines.empty() || vjob.lines.back() != a * line) vjob.lines.push_back(a * line);
+                }
+            }
+        }
+        else if(dec.opt == VMV_X_S) vjob.res = Decoder::sext(v.element(dec.rs2, 0), sew);
+        else if(dec.opt == VMV_S_X) {
+            if(n) v.set_element(dec.rd, 0, val1);
+        }
+        else if(is_vreduce(dec.opt)) {
+            if(n) v.set_element(dec.rd, 0, valu.reduce(dec.opt, sew, v.element(dec.rs1, 0), v.reg(dec.rs2), n));
+        }
+        else {
+            // .vv and .mvv take vs1, .vi the immediate and .vx and .mvx rs1
+            const byte *opd = v.reg(dec.rs1);
+            if(dec.funct3 != 0x0 && dec.funct3 != 0x2) {
+                word val = dec.funct3 == 0x3? word(dec.imm): val1;
+                for(int i = 0; i < n; ++i) std::memcpy(&vbuf[i * sew / 8], &val, sew / 8);
+                opd = vbuf.data();
+            }
+            valu.calc(dec.opt, sew, v.reg(dec.rd), dec.opt == VMV? opd: v.reg(dec.rs2), opd, n);
+        }
+        int per = cfg.vector.lanes * 32 / sew;
+        int depth = 0;
+        while(is_vreduce(dec.opt) && (1 << depth) < per) depth++;
+        vjob.done = cycle + cfg.vector.latency + (n + per - 1) / per + depth - 1;
+    }
+
+    // the vector unit accesses the lines of its instruction one after another, and takes a new
+    // instruction from whichever thread has one at its rob head once the last result left
+    void execute_vector() {
+        if(vjob.busy) {
+            vec_busy++;
+            if(vjob.ticket >= 0 && dmem->ready(vjob.ticket)) {
+                dmem->release(vjob.ticket);
+                vjob.ticket = -1, vjob.next++;
+            }
+            if(vjob.ticket < 0 && vjob.next < vjob.lines.size()) vjob.ticket = dmem->request(vjob.lines[vjob.next], vjob.write);
+            if(vjob.next < vjob.lines.size() || cycle < vjob.done || vec_out.pending()) return ;
+            vec_out.write(CDB_msg(vjob.idx, vjob.res, 0));
+            vec_out.pend(1);
+            send_que.push(&vec_out);
+            vjob.busy = 0;
+            return ;
+        }
+        for(int i = 0; i < threads; ++i) {
+            auto &th = thr[i];
+            // a head with no result pending was committed this cycle
+            if(th.halt_flag || th.vec_started || th.rob.empty() || !is_vector(th.rob.front().opt) || !th.rob.front().cnt) continue;
+            // stores write memory directly, behind the older ones
+            if(is_vstore(th.rob.front().opt) && !store_buf.empty()) continue;
+            use(i);
+            start_vector(th.rob.front());
+            trace(th.rob.front().idx, "X");
+            th.vec_started = 1;
+            return ;
+        }
     }
 
     void execute() {
+        finish(mul_unit, mul_out);
+        finish(div_unit, div_out);
+        finish(fp_unit, fp_out);
+        finish(fdiv_unit, fdiv_out);
+        if(cfg.use_vector) execute_vector();
+        if(!rs.empty()) {
+            auto *item = rs.execute([&](RV32I_Opt opt) {
+                if(is_mul(opt)) return mul_unit.free(cycle);
+                if(is_div(opt)) return div_unit.free(cycle);
+                return false;
+            });
+            if(item) {
+                trace(item->ROBidx, "X");
+                auto &unit = is_mul(item->opt)? mul_unit: div_unit;
+                unit.issue(CDB_msg(item->ROBidx, alu.calc(item->opt, item->val1, item->val2), 0), cycle);
+            }
+        }
         if(!rs.empty()) {
-            auto *item = rs.execute(alu_out);
+            auto *item = rs.execute([&](RV32I_Opt opt) {
+                if(is_fpu(opt)) return fp_unit.free(cycle);
+                if(is_fdiv(opt)) return fdiv_unit.free(cycle);
+                return false;
+            });
             if(item) {
+                trace(item->ROBidx, "X");
+                (is_fpu(item->opt)? fp_unit: fdiv_unit).issue(fp_calc(*item), cycle);
+            }
+        }
+        if(!rs.empty()) {
+            auto *item = rs.execute([&](RV32I_Opt opt) {
+                return !alu_out.pending() && !is_mul(opt) && !is_div(opt) && !is_fpu(opt) && !is_fdiv(opt);
+            });
+            if(item) {
+                trace(item->ROBidx, "X");
                 bool flag = 0;
                 flag |= item->opt == LUI || item->opt == AUIPC;
                 flag |= item->opt > IMM_BEG && item->opt < IMM_END;
@@ -515,41 +1630,40 @@ private:
                     opd2 = Decoder::slice(opd2, 0, 5);
                 }
                 word res = alu.calc(item->opt, opd1, opd2);
-                alu_out.write(CDB_msg(item->ROBidx, res, 0));
+                if(cfg.early_resolve) resolve(*item, res);
+                // sign injection, min/max, compares, fclass and moves are single-cycle bit operations
+                if(is_fp(item->opt)) alu_out.write(fp_calc(*item));
+                // a jump broadcasts its link value, the target travels in the address field
+                else if(item->opt == JALR) alu_out.write(CDB_msg(item->ROBidx, rob_of(item->ROBidx).at(item->ROBidx).nex_pc, res));
+                else alu_out.write(CDB_msg(item->ROBidx, res, 0));
                 alu_out.pend(1);
                 send_que.push(&alu_out);
             }
         }
 
-        if(!slb.empty()) {
-            auto *item = slb.execute(store_out, load_out, store_cnt.count());
+        if(cfg.lsq) execute_lsq();
+        else if(!slb.empty()) {
+            int stores = 0;
+            for(int i = 0; i < threads; ++i) stores += thr[i].store_cnt.count();
+            auto *item = slb.execute(store_out, load_out, stores);
             // auto *item = slb.execute(addrout, load_out);
             if(item) {
+                trace(item->ROBidx, "X");
                 addr_t addr = addr_adder.calc(item->val1, item->imm);
                 // addrout.write(CDB_msg(item->ROBidx, item->val2, addr));
                 // addrout.pend(1);
                 // send_que.push(&addrout);
                 if(item->opt > LOAD_BEG && item->opt < LOAD_END) {
-                    word res;
-                    switch(item->opt) {
-                        case LB: res = 0; break;
-                        case LH: res = 1; break;
-                        case LW: res = 2; break;
-                        case LBU: res = 3; break;
-                        case LHU: res = 4; break;
-                    }
-                    // switch(item->opt) {
-                    //     case LB: res = Decoder::sext(ram.read_byte(addr), 8); break;
-                    //     case LH: res = Decoder::sext(ram.read_hfword(addr), 16); break;
-                    //     case LW: res = ram.read_word(addr); break;
-                    //     case LBU: res = ram.read_byte(addr); break;
-                    //     case LHU: res = ram.read_hfword(addr); break;
-                    // }
-                    load_delay.input(Load_msg(item->opt, item->ROBidx, addr));
+                    if(prefetcher) prefetcher->observe(rob_of(item->ROBidx).at(item->ROBidx).cur_pc, addr);
+                    // a load the store buffer covers entirely does not access the cache
+                    bool hit = store_buf.coalescing() && store_buf.covers(addr, mem_width(item->opt));
+                    if(hit) load_req = (Mem_req) {item->opt, item->ROBidx, load_value(item->opt, addr), addr, LOAD_FORWARDED};
+                    else load_req = (Mem_req) {item->opt, item->ROBidx, 0, addr, dmem->request(addr, 0)};
+                    load_busy = 1;
                     load_out.pend(1);
                 }
                 else {
-                    store_cnt.inc();
+                    owner(item->ROBidx).store_cnt.inc();
                     store_out.write(CDB_msg(item->ROBidx, item->val2, addr));
                     store_out.pend(1);
                     send_que.push(&store_out);
@@ -558,12 +1672,55 @@ private:
         }
     }
 
+    void execute_lsq() {
+        int pos = store_out.pending()? -1: lsq.store_ready();
+        if(~pos) {
+            auto &item = lsq[pos];
+            trace(item.op.ROBidx, "X");
+            store_out.write(CDB_msg(item.op.ROBidx, item.op.val2, item.addr()));
+            store_out.pend(1);
+            send_que.push(&store_out);
+            lsq.mark_sent(pos);
+            int ld = cfg.store_sets? lsq.violation(pos): -1;
+            if(~ld) {
+                rob_of(lsq[ld].op.ROBidx).replay(lsq[ld].op.ROBidx);
+                ssets.violation(lsq[ld].pc, item.pc);
+            }
+        }
+        int fwd;
+        pos = load_busy || load_out.pending()? -1: lsq.load_ready(fwd);
+        if(~pos) {
+            auto &item = lsq[pos];
+            trace(item.op.ROBidx, "X");
+            RV32I_Opt opt = item.op.opt;
+            if(prefetcher) prefetcher->observe(item.pc, item.addr());
+            if(~fwd) load_req = (Mem_req) {opt, item.op.ROBidx, extend(opt, lsq.forward(fwd, pos)), item.addr(), LOAD_FORWARDED};
+            else if(store_buf.coalescing() && store_buf.covers(item.addr(), mem_width(opt))) {
+                load_req = (Mem_req) {opt, item.op.ROBidx, load_value(opt, item.addr()), item.addr(), LOAD_FORWARDED};
+            }
+            else load_req = (Mem_req) {opt, item.op.ROBidx, 0, item.addr(), dmem->request(item.addr(), 0)};
+            lsq.mark_sent(pos, fwd);
+            load_busy = 1;
+            load_out.pend(1);
+        }
+    }
+
     void write_result() {
         if(cdb.traffic()) {
+            if(!send_que.empty()) stats.stall(CDB_BUSY);
             auto msg = cdb.recv();
-            rob.update(std::get<0>(msg), std::get<1>(msg), std::get<2>(msg));
-            rs .update(std::get<0>(msg), std::get<1>(msg));
-            slb.update(std::get<0>(msg), std::get<1>(msg));
+            auto &th = owner(std::get<0>(msg));
+            auto tag = th.rob.tag(std::get<0>(msg));
+            th.rob.update(std::get<0>(msg), std::get<1>(msg), std::get<2>(msg));
+            auto &entry = th.rob.at(std::get<0>(msg));
+            if(ktrace.opened()) ktrace.stage(cycle, entry.uid, "Wb");
+            if(entry.predicted && entry.pred != std::get<1>(msg)) request_squash(th, entry.idx, entry.nex_pc);
+            if(tag) {
+                th.prf.write(tag, std::get<1>(msg));
+                rs .update(tag, std::get<1>(msg));
+                slb.update(tag, std::get<1>(msg));
+                lsq.update(tag, std::get<1>(msg));
+            }
         }
         else {
             if(!send_que.empty()) {
@@ -572,116 +1729,371 @@ private:
                 send_que.pop();
             }
         }
-        if(store_delay.signaled()) {
-            auto out = store_delay.output();
-            auto opt = std::get<0>(out);
-            auto data = std::get<1>(out);
-            auto addr = std::get<2>(out);
-            switch(opt) {
-                case SB: ram.write_byte(addr, data); break;
-                case SH: ram.write_hfword(addr, data); break;
-                case SW: ram.write_word(addr, data); break;
+        store_buf.drain();
+        if(load_busy) {
+            if(load_req.ticket == -1) load_req.ticket = dmem->request(load_req.addr, 0);
+            else if(load_req.ticket == LOAD_FORWARDED || dmem->ready(load_req.ticket)) {
+                if(load_req.ticket >= 0) dmem->release(load_req.ticket);
+                word data = load_req.ticket == LOAD_FORWARDED? load_req.data: load_value(load_req.opt, load_req.addr);
+                load_out.write(CDB_msg(load_req.ROBidx, data, load_req.addr));
+                send_que.push(&load_out);
+                load_busy = 0;
             }
         }
-        if(load_delay.signaled()) {
-            auto out = load_delay.output();
-            auto opt = std::get<0>(out);
-            auto idx = std::get<1>(out);
-            auto addr = std::get<2>(out);
-            word data = 0;
-            switch(opt) {
-                case LB: data = Decoder::sext(ram.read_byte(addr), 8); break;
-                case LH: data = Decoder::sext(ram.read_hfword(addr), 16); break;
-                case LW: data = ram.read_word(addr); break;
-                case LBU: data = ram.read_byte(addr); break;
-                case LHU: data = ram.read_hfword(addr); break;
+    }
+
+    // a system call runs once every older instruction is committed and every older store has drained
+    void syscall() {
+        // one call per cycle: with --smt the other thread may have filled sys_out earlier in this commit
+        if(t->rob.front().opt != ECALL || t->sys_busy || !store_buf.empty() || sys_out.pending() || sys_out.taken()) return ;
+        word num = t->prf.arch_read(17);
+        t->sys_res = sys.call(num, t->prf.arch_read(10), t->prf.arch_read(11), t->prf.arch_read(12), cycle);
+        trace(t->rob.front().idx, "X");
+        sys_out.write(CDB_msg(t->rob.front().idx, t->sys_res.ret, 0));
+        sys_out.pend(1);
+        send_que.push(&sys_out);
+        t->sys_busy = 1;
+    }
+
+    // one instruction commits per cycle, the threads take turns when several are ready
+    int commit() {
+        int first = -1;
+        Stall_reason why = COMMIT_EMPTY;
+        Cpi_slot slot = CPI_FRONTEND;
+        for(int k = 0; k < threads; ++k) {
+            int i = (commit_rr + k) % threads;
+            if(thr[i].halt_flag) continue;
+            use(i);
+            int code = commit_thread();
+            if(!code) {
+                if(first < 0) first = i, why = blocked, slot = lost;
+                continue;
             }
-            load_out.write(CDB_msg(idx, data, addr));
-            send_que.push(&load_out);
+            commit_rr = (i + 1) % threads;
+            stats.slot(CPI_RETIRING);
+            return code;
         }
+        // the slot is charged to the thread that had the first turn
+        if(first >= 0) stats.stall(why), stats.slot(slot);
+        return 0;
     }
 
-    int commit() {
-        if(rob.empty()) return 0;
-        auto *item = rob.commit();
-        if(!item) return 0;
+    // the head waits on memory rather than on a functional unit
+    static bool memory_bound(RV32I_Opt opt) {
+        return is_load(opt) || is_store(opt) || is_vload(opt) || is_vstore(opt) || serial(opt);
+    }
+
+    int commit_thread() {
+        if(t->rob.empty()) return block(COMMIT_EMPTY, t->refill? CPI_BAD_SPEC: CPI_FRONTEND);
+        syscall();
+        if(serial(t->rob.front().opt)) {
+            if(!store_buf.empty()) return block(COMMIT_SERIAL, CPI_MEMORY);
+            if(t->rob.front().opt != FENCE && t->rob.front().opt < SYS_BEG) {
+                // atomics pay for one data cache access
+                if(t->serial_ticket < 0) t->serial_ticket = dmem->request(t->prf.arch_read(Decoder::slice(t->rob.front().org, 15, 20)), 1);
+                if(t->serial_ticket < 0 || !dmem->ready(t->serial_ticket)) return block(COMMIT_SERIAL, CPI_MEMORY);
+                dmem->release(t->serial_ticket), t->serial_ticket = -1;
+            }
+        }
+        auto &head = t->rob.front();
+        if(head.replay) {
+            // a mispredicted memory dependence, refetch from the load
+            t->flush_flag = 1;
+            t->jump_to = head.cur_pc;
+            return block(COMMIT_WAIT, CPI_BAD_SPEC);
+        }
+        if(is_store(head.opt) && !head.cnt && !store_buf.accept(head.addr, mem_width(head.opt))) return block(COMMIT_STORE_BUF, CPI_MEMORY);
+        auto *item = t->rob.commit();
+        if(!item) return block(COMMIT_WAIT, memory_bound(head.opt)? CPI_MEMORY: CPI_CORE);
+        if(ktrace.opened()) {
+            ktrace.stage(cycle, item->uid, "Cm"), ktrace.retire(cycle, item->uid);
+            if(item->fused) ktrace.stage(cycle, item->uid2, "Cm"), ktrace.retire(cycle, item->uid2);
+        }
+        if(ctrace.opened() && !serial(item->opt)) trace_commit(*item, item->dest? t->prf.read(item->pdst): 0);
         inst_t org_inst = item->org;
+        if(cfg.lsq && (is_load(item->opt) || is_store(item->opt))) lsq.commit();
+        if(cfg.store_sets && is_store(item->opt)) ssets.retire(item->cur_pc, item->idx);
+        if(btrace.opened()) btrace.step();
+        if(item->fused) {
+            t->inst_num++;
+            stats.retire();
+            if(btrace.opened()) btrace.step();
+        }
 
         // Branch
         if(item->opt > BRANCH_BEG && item->opt < BRANCH_END) {
-            bool mis_flag = 0;
-            bool act_flag = 0;
-            switch(item->opt) {
-                case BEQ: act_flag = item->data == 0; break;
-                case BNE: act_flag = item->data != 0; break;
-                case BLT: case BLTU: act_flag = item->data == 1; break;
-                case BGE: case BGEU: act_flag = item->data == 0; break;
-            }
-            mis_flag = act_flag != item->jump;
+            bool act_flag = branch_taken(item->opt, item->data);
+            bool mis_flag = act_flag != item->jump;
             spec.feedback(item->cur_pc, act_flag, mis_flag);
-            if(mis_flag) {
-                flush_flag = 1;
-                jump_to = item->mis_pc;
+            t->hpm[HPM_BRANCH]++;
+            t->hpm[HPM_MISPREDICT] += mis_flag;
+            if(btrace.opened()) {
+                btrace.record(item->cur_pc, item->jump? item->nex_pc: item->mis_pc, act_flag);
+            }
+            if(mis_flag && !item->resolved) {
+                t->flush_flag = 1;
+                t->jump_to = item->mis_pc;
             }
             return org_inst;
         }
         // Store
         if(item->opt > STORE_BEG && item->opt < STORE_END) {
-            store_cnt.dec();
-            store_delay.input(Store_msg(item->opt, item->data, item->addr));
+            if(!cfg.lsq) t->store_cnt.dec();
+            t->hpm[HPM_STORE]++;
+            store_buf.push(item->addr, item->data, mem_width(item->opt));
+            return org_inst;
+        }
+        // System call, only those writing guest memory replay the younger instructions
+        if(item->opt == ECALL) {
+            t->prf.commit(item->dest, item->pdst);
+            t->sys_busy = 0;
+            if(t->sys_res.exit) t->halt_flag = 1;
+            else if(t->sys_res.mem_write) {
+                t->flush_flag = 1;
+                t->jump_to = item->nex_pc;
+            }
             return org_inst;
         }
-        // Jump
-        word write_data;
-        if(item->opt == JALR) {
-            pc.write(item->data & ~1u);
-            write_data = item->nex_pc;
-            stall.set(0);
+        // Vector, registers and memory were updated in the vector unit
+        if(is_vector(item->opt)) {
+            t->prf.commit(item->dest, item->pdst);
+            t->vec_started = 0;
+            if(is_vstore(item->opt)) t->stall.set(0);
+            return org_inst;
+        }
+        // Atomic, fence and csr
+        if(serial(item->opt)) {
+            word res = serial_exec(org_inst);
+            if(ctrace.opened()) trace_commit(*item, res);
+            t->prf.write(item->pdst, res);
+            t->prf.commit(item->dest, item->pdst);
+            t->stall.set(0);
+            return org_inst;
         }
-        else write_data = item->data;
+        // Jump, fetch waited for the target unless it was redirected when the jump executed
+        if(item->opt == JALR && !cfg.early_resolve) {
+            t->pc.write(item->addr & ~1u);
+            t->stall.set(0);
+        }
+        if(vp && is_load(item->opt)) vp->train(item->cur_pc, item->data, item->predicted, item->pred == item->data);
+        if(is_fp(item->opt)) t->fcsr |= item->addr & 31;
+        if(is_load(item->opt)) t->hpm[HPM_LOAD]++;
         // Ohters
-        auto rd = item->dest;
-        regfile.write(rd, write_data);
-        regfile.reset(rd, item->idx);
+        t->prf.commit(item->dest, item->pdst, !item->moved);
         return org_inst;
     }
 
-    void tick() {
-        cycle++;
-        if(flush_flag) {
-            pc.write(jump_to);
-            store_cnt.set(0);
-            rs.flush(), slb.flush(), rob.flush();
-            regfile.flush(), inst_que.flush(), send_que.flush();
+    // back to the committed state of the current thread, restarting at jump_to
+    void flush() {
+        t->pc.write(t->jump_to);
+        t->store_cnt.set(0);
+        if(threads == 1) {
+            rs.flush(), slb.flush(), lsq.flush();
+            send_que.flush();
             cdb.flush(), alu_out.flush(), store_out.flush(), load_out.flush();
+            mul_unit.flush(), div_unit.flush(), mul_out.flush(), div_out.flush(), sys_out.flush();
+            fp_unit.flush(), fdiv_unit.flush(), fp_out.flush(), fdiv_out.flush();
             // addrout.flush(),
-            load_delay.flush();
-            stall.set(0);
-            flush_flag = 0;
-        }
-        store_cnt.tick();
-        stall.tick();
-        pc.tick();
-        regfile.tick();
-        inst_que.tick();
+            if(load_busy && load_req.ticket >= 0) dmem->release(load_req.ticket);
+            load_busy = 0;
+            vec_out.flush();
+            if(vjob.busy) abort_vector();
+        }
+        else drop([&](byte idx) {return &owner(idx) == t; });
+        if(ktrace.opened()) {
+            t->rob.each([&](const ROB_item &item) {trace_flush(item); });
+            t->inst_que.each([&](const InstQue_node &node) {ktrace.flush(cycle, node.uid); });
+        }
+        t->rob.flush();
+        ssets.flush();
+        if(vp) vp->flush();
+        t->prf.flush(), t->inst_que.flush();
+        if(t->fetch_ticket >= 0) icache->release(t->fetch_ticket), t->fetch_ticket = -1;
+        t->fetch_split = 0;
+        t->lsd.flush();
+        t->stall.set(0);
+        t->flush_flag = 0;
+        t->squash_idx = 0;
+        t->vec_started = 0;
+        t->refill = 1;
+        stats.stall(FETCH_FLUSH);
+    }
+
+    long long total_insts() {
+        long long insts = 0;
+        for(int i = 0; i < threads; ++i) insts += thr[i].inst_num;
+        return insts;
+    }
+    long long total_misses() {
+        long long misses = 0;
+        for(int i = 0; i < threads; ++i) misses += thr[i].hpm[HPM_MISPREDICT];
+        return misses;
+    }
+
+    // run the instruction at `t`'s pc to completion on the committed state
+    void execute_functional() {
+        addr_t cur_pc = t->pc.read();
+        inst_t inst = ram.read_word(cur_pc);
+        byte len = Decoder::compressed(inst)? 2: 4;
+        if(len == 2) inst = Decoder::expand(inst & 0xffff);
+        t->inst_num++, ff_insts++;
+        if(inst == 0x0ff00513) {
+            if(ctrace.opened()) trace_commit(cur_pc, inst, 10, 0xff);
+            t->halt_flag = 1;
+            t->exit_a0 = t->prf.arch_read(10);
+            return ;
+        }
+        if(inst == ROI_BEGIN) begin_roi();
+        decoder.decode(inst);
+        auto opt = decoder.opt;
+        word val1 = t->prf.arch_read(decoder.rs1), val2 = t->prf.arch_read(decoder.rs2);
+        word imm = decoder.imm, res = 0;
+        addr_t nex_pc = cur_pc + len;
+        int dest = writes_rd()? decoder.rd: 0;
+        if(is_branch(opt)) {
+            t->hpm[HPM_BRANCH]++;
+            if(branch_taken(opt, alu.calc(opt, val1, val2))) nex_pc = cur_pc + imm;
+        }
+        else if(opt == LUI) res = imm;
+        else if(opt == AUIPC) res = cur_pc + imm;
+        else if(opt == JAL) res = cur_pc + len, nex_pc = cur_pc + imm;
+        else if(opt == JALR) res = cur_pc + len, nex_pc = (val1 + imm) & ~1u;
+        else if(is_load(opt)) {
+            t->hpm[HPM_LOAD]++;
+            res = load_value(opt, val1 + imm);
+        }
+        else if(is_store(opt)) {
+            t->hpm[HPM_STORE]++;
+            for(int i = 0; i < mem_width(opt); ++i) ram.write_byte(val1 + imm + i, val2 >> 8 * i);
+        }
+        else if(serial(opt)) res = serial_exec(inst);
+        else if(opt == ECALL) {
+            auto call = sys.call(t->prf.arch_read(17), t->prf.arch_read(10), t->prf.arch_read(11), t->prf.arch_read(12), cycle);
+            if(call.exit) {
+                t->halt_flag = 1;
+                t->exit_a0 = t->prf.arch_read(10);
+            }
+            res = call.ret, dest = 10;
+        }
+        else if(is_fp(opt)) {
+            word flags = 0;
+            word val3 = is_fma(opt)? t->prf.arch_read(decoder.rs3): 0;
+            res = fpu.calc(opt, val1, val2, val3, decoder.funct3 == 0x7? t->fcsr >> 5: decoder.funct3, flags);
+            t->fcsr |= flags;
+        }
+        else if(is_vector(opt)) {
+            dest = 0;
+            if(cfg.use_vector) {
+                // the vector unit's counters only cover detailed simulation
+                long long insts = vec_insts, elems = vec_elems;
+                ROB_item head;
+                head.org = inst, head.idx = 0;
+                start_vector(head);
+                vjob.busy = 0;
+                vec_insts = insts, vec_elems = elems;
+                res = vjob.res, dest = vector_rd();
+            }
+        }
+        else if(opt != NONE) {
+            word opd2 = opt > IMM_BEG && opt < IMM_END? imm: val2;
+            switch(opt) {
+                case SLL: case SRL: case SRA:
+                case SLLI: case SRLI: case SRAI:
+                opd2 = Decoder::slice(opd2, 0, 5);
+            }
+            res = alu.calc(opt, val1, opd2);
+        }
+        // dropped at issue when simulating in detail
+        bool dropped = opt == NONE || (is_vector(opt) && !cfg.use_vector);
+        if(ctrace.opened() && !dropped) trace_commit(cur_pc, inst, dest, res, opt, val1 + imm, val2);
+        t->prf.arch_write(dest, res);
+        t->pc.init(nex_pc);
+    }
+
+    // one instruction per live thread and cycle, the memory hierarchy stands still
+    void fast_forward() {
+        for(int i = 0; i < threads && !detailed; ++i) {
+            if(thr[i].halt_flag) continue;
+            use(i);
+            execute_functional();
+        }
+        cycle++, ff_cycles++;
+    }
+
+    void begin_roi() {
+        detailed = 1;
+        roi_count++;
+        roi_insts = total_insts(), roi_cycles = cycle, roi_misses = total_misses();
+    }
+
+    // `done` committed the end marker: report the region and restart every thread from its
+    // committed state, which is where functional execution picks up once the stores drained
+    void end_roi(Thread &done) {
+        std::string tag = coreid? "[core " + std::to_string(coreid) + "] ": "";
+        long long insts = total_insts() - roi_insts, cycles = cycle - roi_cycles;
+        std::cerr << tag << "[roi " << roi_count << "] instructions " << insts << " cycles " << cycles;
+        std::cerr << " ipc " << (cycles? 1.0 * insts / cycles: 0.0) << " mispredicts " << total_misses() - roi_misses << '\n';
+        for(int i = 0; i < threads; ++i) {
+            auto &th = thr[i];
+            if(th.halt_flag) continue;
+            th.flush_flag = 1;
+            if(&th == &done) th.jump_to = th.rob.front().nex_pc;
+            else if(!th.rob.empty()) th.jump_to = th.rob.front().cur_pc;
+            else if(!th.inst_que.empty()) th.jump_to = th.inst_que.front().pc;
+            else th.jump_to = th.pc.read();
+        }
+        roi_leaving = 1;
+    }
+
+    void leave_roi() {
+        store_buf.drain();
+        if(store_buf.empty()) {
+            roi_leaving = detailed = 0;
+            return ;
+        }
+        ff_cycles++;
+        tick();
+    }
+
+    void tick() {
+        cycle++;
+        for(int i = 0; i < threads; ++i) {
+            use(i);
+            if(t->flush_flag) flush();
+            else if(t->squash_idx) squash();
+        }
+        for(int i = 0; i < threads; ++i) {
+            auto &th = thr[i];
+            th.store_cnt.tick();
+            th.stall.tick();
+            th.pc.tick();
+            th.prf.tick();
+            th.inst_que.tick();
+            th.rob.tick();
+        }
         send_que.tick();
         rs.tick();
         slb.tick();
-        rob.tick();
+        lsq.tick();
         cdb.tick();
         alu_out.tick();
         store_out.tick();
         // addrout.tick();
         load_out.tick();
-        load_delay.tick();
-        store_delay.tick();
+        mul_out.tick();
+        div_out.tick();
+        fp_out.tick();
+        fdiv_out.tick();
+        sys_out.tick();
+        vec_out.tick();
+        for(auto &level: mem_levels) level->tick();
     }
 
     void print() {
         std::cout << "+----------------------------- LOG ---------------------------+\n";
-        std::cout << "[pc] " << std::hex << std::setw(8) << std::setfill('0') << pc.read() << '\n';
+        std::cout << "[pc] " << std::hex << std::setw(8) << std::setfill('0') << t->pc.read() << '\n';
         std::cout << "[regfile]\n";
-        regfile.print();
+        t->prf.print();
         std::cout << "[cdb] ";
         if(cdb.traffic()) {
             auto msg = cdb.recv();
@@ -699,42 +2111,262 @@ private:
         std::cout << "[reservation station]\n";
         rs.print(); 
         std::cout << "[store load buffer] ";
-        std::cout << std::dec << store_cnt.count() << "\n";
-        slb.print();
+        std::cout << std::dec << t->store_cnt.count() << "\n";
+        if(cfg.lsq) lsq.print();
+        else slb.print();
         std::cout << "[reorder buffer]\n";
-        rob.print();
-        std::cout << "[store delay] ";
-        if(store_delay.signaled()) {
-            auto msg = store_delay.output();
-            std::cout << std::setw(5) << std::setfill(' ') << opt_to_string(std::get<0>(msg)) << " ";
-            std::cout << std::setw(8) << std::setfill('0') << std::hex << word(std::get<1>(msg)) << " ";
-            std::cout << std::setw(8) << std::setfill('0') << std::hex << word(std::get<2>(msg)) << "\n"; 
-        }
-        else std::cout << "no signal\n";
-        std::cout << "[ load delay] ";
-        if(load_delay.signaled()) {
-            auto msg = load_delay.output();
-            std::cout << "#" << std::setw(4) << std::setfill('0') << std::dec << word(std::get<0>(msg)) << " ";
-            std::cout << std::setw(8) << std::setfill('0') << std::hex << word(std::get<1>(msg)) << " ";
-            std::cout << std::setw(8) << std::setfill('0') << std::hex << word(std::get<2>(msg)) << "\n"; 
-        }
-        else std::cout << "no signal\n";
+        t->rob.print();
+        std::cout << "[store buffer] ";
+        store_buf.print();
+        std::cout << "[ load] ";
+        if(load_busy) {
+            std::cout << "#" << std::setw(4) << std::setfill('0') << std::dec << word(load_req.ROBidx) << " ";
+            std::cout << std::setw(5) << std::setfill(' ') << opt_to_string(load_req.opt) << " ";
+            std::cout << std::setw(8) << std::setfill('0') << std::hex << word(load_req.addr) << "\n"; 
+        }
+        else std::cout << "idle\n";
         std::cout << std::endl;
     }
 
+    void build_memory() {
+        int latency = cfg.mem_latency;
+        if(!latency) latency = cfg.use_l1d || cfg.use_l2? 100: 3;
+        if(cfg.use_dram) mem_levels.emplace_back(new Dram(cfg.dram));
+        else mem_levels.emplace_back(new Fixed_memory(latency));
+        Memory_level *lower = mem_levels.back().get();
+        if(cfg.use_l2) {
+            mem_levels.emplace_back(new Cache("l2", cfg.l2, lower));
+            lower = mem_levels.back().get();
+        }
+        dmem = lower, icache = nullptr, prefetcher = nullptr;
+        if(cfg.use_prefetch) {
+            int line = cfg.use_l1d? cfg.l1d.line: cfg.use_l2? cfg.l2.line: 64;
+            prefetcher = new Stride_prefetcher(cfg.prefetch, lower, line);
+            mem_levels.emplace_back(prefetcher);
+            dmem = prefetcher;
+        }
+        if(cfg.use_l1d) {
+            mem_levels.emplace_back(new Cache("l1d", cfg.l1d, dmem));
+            dmem = mem_levels.back().get();
+        }
+        if(cfg.use_l1i) {
+            icache = new Cache("l1i", cfg.l1i, lower);
+            mem_levels.emplace_back(icache);
+        }
+        store_buf.init(dmem, cfg.store_buffer, cfg.use_l1d? cfg.l1d.line: 64);
+    }
+
     void init() {
-        flush_flag = 0;
-        cycle = 0, inst_num = 0;
-        pc.init(0);
-        stall.init(0);
-        store_cnt.init(0);
+        halt_flag = 0;
+        squashes = 0;
+        fusion = Fusion_stat{0, 0, 0, 0};
+        load_busy = 0;
+        cycle = 0;
+        threads = cfg.smt;
+        fetch_rr = issue_rr = commit_rr = 0;
+        for(int i = 0; i < threads; ++i) {
+            use(i);
+            t->hartid = coreid * threads + i;
+            t->flush_flag = 0;
+            t->halt_flag = 0;
+            t->serial_ticket = -1;
+            t->sys_busy = 0;
+            t->squash_idx = 0;
+            t->fetch_ticket = -1, t->fetch_valid = 0, t->fetch_split = 0;
+            t->inst_num = 0;
+            t->pc.init(0);
+            t->prf.init(cfg.phys_regs, i * 128);
+            t->rob.init(i * 16);
+            t->stall.init(0);
+            t->store_cnt.init(0);
+            t->lsd.init(cfg.loop_buffer);
+            t->vrf.init(cfg.vector.vlen);
+            t->vec_started = 0;
+            t->fcsr = 0;
+            for(auto &x: t->hpm) x = 0;
+            for(auto &x: t->ctr_base) x = 0;
+            t->refill = 0;
+        }
+        stats.init(16, 16, 16 * threads, 16);
+        vjob.busy = 0;
+        vbuf.assign(cfg.vector.vlen / 8, 0);
+        vec_insts = vec_elems = vec_busy = 0;
+        detailed = !cfg.roi, roi_leaving = 0;
+        roi_count = 0;
+        ff_insts = ff_cycles = 0;
+        use(0);
+        mul_unit.init(cfg.mul_latency, 1);
+        div_unit.init(cfg.div_latency, 0);
+        fp_unit.init(cfg.fp_latency, 1);
+        fdiv_unit.init(cfg.fdiv_latency, 0);
+        lsq.init(cfg.store_sets);
+    }
+
+public:
+    Core(const Config &config, RAM<MEM_SIZE> &mem, Syscall<MEM_SIZE> &syscall, int id):
+        cfg(config), coreid(id), ram(mem), sys(syscall), store_buf(mem), spec(cfg.bp) {
+        init();
+        build_memory();
+        if(!cfg.value_pred.empty()) vp.reset(new Value_predictor(cfg.value_pred == "stride"));
+        if(!cfg.branch_trace.empty()) {
+            std::string path = cfg.branch_trace;
+            if(coreid) path += "." + std::to_string(coreid);
+            if(!btrace.open(path)) std::cerr << "cannot open branch trace " << path << std::endl;
+        }
+        if(!cfg.stats.empty()) {
+            std::string path = cfg.stats;
+            if(coreid) path += "." + std::to_string(coreid);
+            if(!stats.open(path, cfg.stats_interval)) std::cerr << "cannot open statistics file " << path << std::endl;
+        }
+        if(!cfg.pipe_trace.empty()) {
+            std::string path = cfg.pipe_trace;
+            if(coreid) path += "." + std::to_string(coreid);
+            if(!ktrace.open(path)) std::cerr << "cannot open pipeline trace " << path << std::endl;
+        }
+        if(!cfg.commit_trace.empty()) {
+            std::string path = cfg.commit_trace;
+            if(coreid) path += "." + std::to_string(coreid);
+            if(!ctrace.open(path)) std::cerr << "cannot open commit trace " << path << std::endl;
+        }
+    }
+
+    bool halted() {return halt_flag; }
+
+    // one clock cycle
+    void step() {
+        if(!detailed) {
+            fast_forward();
+            halt_flag = 1;
+            for(int i = 0; i < threads; ++i) halt_flag &= thr[i].halt_flag;
+            return ;
+        }
+        if(roi_leaving) return leave_roi();
+        inst_t code = commit();
+        Thread *done = t;
+        write_result();
+        execute();
+        issue();
+        fetch();
+        if(code) done->inst_num++, stats.retire();
+        if(cfg.roi && code == ROI_END) end_roi(*done);
+        if(code == 0x0ff00513 || done->halt_flag) {
+            done->halt_flag = 1;
+            done->exit_a0 = done->prf.arch_read(10);
+            // the thread is gone, what it still has in flight must not hold up the others
+            done->flush_flag = 1;
+        }
+        halt_flag = 1;
+        for(int i = 0; i < threads; ++i) halt_flag &= thr[i].halt_flag;
+        if(halt_flag) return ;
+        int rob_len = 0;
+        for(int i = 0; i < threads; ++i) rob_len += thr[i].rob.size();
+        stats.sample(rs.size(), cfg.lsq? lsq.size(): slb.size(), rob_len, send_que.size());
+        tick();
+    }
+
+    word result() {
+        return thr[0].exit_a0 & 255u;
+    }
+
+    void report() {
+        std::string tag = coreid? "[core " + std::to_string(coreid) + "] ": "";
+        // with --roi only the regions count, the per-thread figures below stay architectural
+        long long insts = total_insts() - ff_insts, cycles = cycle - ff_cycles;
+        std::cerr << tag << std::dec << insts << std::endl;
+        std::cerr << tag << std::dec << cycles << std::endl;
+        std::cerr << tag << std::dec << std::setprecision(4) << spec.accuracy() << std::endl;
+        if(cfg.bp_report) spec.report(cfg.bp_report);
+        btrace.close();
+        ktrace.close();
+        ctrace.close();
+        if(cfg.fusion) {
+            std::cerr << tag << "[fusion] lui+addi " << fusion.lui_addi << " auipc+addi " << fusion.auipc_addi;
+            std::cerr << " auipc+jalr " << fusion.auipc_jalr << " moves eliminated " << fusion.moves << '\n';
+        }
+        if(stats.opened()) {
+            auto &total = stats.total();
+            std::cerr << tag << "[cpi] " << (total.insts? 1.0 * total.cycles / total.insts: 0.0) << " =";
+            for(int i = 0; i < CPI_SLOTS; ++i) {
+                std::cerr << (i? " + ": " ") << cpi_name(i) << ' ' << (total.insts? 1.0 * total.cpi[i] / total.insts: 0.0);
+            }
+            std::cerr << '\n';
+            stats.close();
+        }
+        if(cfg.early_resolve) std::cerr << tag << "[early resolve] selective squashes " << squashes << '\n';
+        if(vp) {
+            std::cerr << tag;
+            vp->report(std::cerr);
+        }
+        if(cfg.use_vector) {
+            std::cerr << tag << "[vector] vlen " << cfg.vector.vlen << " lanes " << cfg.vector.lanes;
+            std::cerr << " instructions " << vec_insts << " elements " << vec_elems;
+            std::cerr << " (" << (vec_insts? 1.0 * vec_elems / vec_insts: 0.0) << " per instruction) busy cycles " << vec_busy << '\n';
+        }
+        if(threads > 1) {
+            std::cerr << tag << "[smt] " << threads << " threads, " << cfg.fetch_policy << " fetch";
+            std::cerr << ", combined ipc " << (cycles? 1.0 * insts / cycles: 0.0) << '\n';
+            for(int i = 0; i < threads; ++i) {
+                std::cerr << tag << "[thread " << i << "] instructions " << thr[i].inst_num;
+                std::cerr << " ipc " << (cycle? 1.0 * thr[i].inst_num / cycle: 0.0) << '\n';
+            }
+        }
+        for(int i = 0; i < threads; ++i) {
+            if(!thr[i].lsd.enabled()) continue;
+            std::cerr << tag;
+            if(threads > 1) std::cerr << "[thread " << i << "] ";
+            thr[i].lsd.report(std::cerr);
+        }
+        if(cfg.lsq) {
+            std::cerr << tag;
+            lsq.report(std::cerr);
+        }
+        if(store_buf.coalescing()) {
+            std::cerr << tag;
+            store_buf.report(std::cerr);
+        }
+        if(cfg.use_l1i || cfg.use_l1d || cfg.use_l2 || cfg.use_dram || cfg.use_prefetch) {
+            for(auto it = mem_levels.rbegin(); it != mem_levels.rend(); ++it) {
+                std::cerr << tag;
+                (*it)->report(std::cerr);
+            }
+        }
+    }
+
+};
+
+// cores share one guest memory and run in lockstep quanta, spread over host threads
+class simulator {
+private:
+    Config cfg;
+    RAM<Core::MEM_SIZE> ram;
+    Syscall<Core::MEM_SIZE> sys;
+    std::vector<std::unique_ptr<Core> > cores;
+
+    // each host thread runs the cores congruent to its id, quantum after quantum
+    void worker(int id, int threads, Barrier &barrier, bool &finished) {
+        while(!finished) {
+            for(int i = id; i < int(cores.size()); i += threads) {
+                auto &core = *cores[i];
+                for(int c = 0; c < cfg.quantum && !core.halted(); ++c) core.step();
+            }
+            barrier.wait([&]() {
+                finished = 1;
+                for(auto &core: cores) finished &= core->halted();
+            });
+        }
     }
 
 public:
+    explicit simulator(const Config &config = Config()): cfg(config), sys(ram) {
+        if(!cfg.input.empty() && !sys.open_input(cfg.input)) {
+            std::cerr << "cannot open input " << cfg.input << std::endl;
+            exit(1);
+        }
+    }
 
     void scan() {
         std::string buff;
-        addr_t addr;
+        addr_t addr, top = 0;
         word data;
         while(std::cin >> buff) {
             if(buff[0] == '@') {
@@ -746,44 +2378,33 @@ public:
                 ss >> std::hex >> data;
                 ram.write_byte(addr, data);
                 addr++;
+                top = std::max(top, addr);
             }
         }
+        sys.set_brk(top);
     }
 
     void run() {
-int tot = 0;
-int cnt = 10000;
-        inst_t code;
-        while(1) {
-            code = commit();
-            write_result();
-            execute();
-            issue();
-            fetch();
-            if(code) inst_num++;
-            if(code == 0x0ff00513) break;
-            tick();
-//             if(cnt > 0) {
-//                 if(code) tot++;
-// // std::cerr << std::dec << tot << " " << std::hex << std::setw(8) << std::setfill('0') << tmp << std::endl;
-//                 if(code) {
-//                     std::cout << "[commit code] ";
-//                     std::cout << std::hex << std::setw(8) << std::setfill('0') << word(code) << " ";
-//                     std::cout << std::dec << "#" << tot << std::endl;
-//                 }
-//                 cnt--;
-//                 if(code) {
-//                     // std::cout << "[pc] " << std::hex << std::setw(8) << std::setfill('0') << word(pc.read()) << std::endl;
-//                     regfile.print();
-//                     // std::cout << std::hex << std::setw(8) << std::setfill('0') << ram.read_word(0x12e4) << std::endl;
-//                     // print();
-//                 }
-//             }
-        }
-        std::cerr << std::dec << inst_num << std::endl;
-        std::cerr << std::dec << cycle << std::endl;
-        std::cerr << std::dec << std::setprecision(4) << spec.accuracy() << std::endl;
-        std::cout << std::dec << (regfile.read(10) & 255u) << std::endl;
+        ram.init_harts(cfg.cores * cfg.smt);
+        for(int i = 0; i < cfg.cores; ++i) cores.emplace_back(new Core(cfg, ram, sys, i));
+        if(cfg.cores == 1) {
+            auto &core = *cores[0];
+            while(!core.halted()) core.step();
+        }
+        else {
+            int threads = std::max(1, std::min(cfg.threads, cfg.cores));
+            Barrier barrier(threads);
+            bool finished = 0;
+            std::vector<std::thread> pool;
+            for(int t = 1; t < threads; ++t) {
+                pool.emplace_back(&simulator::worker, this, t, threads, std::ref(barrier), std::ref(finished));
+            }
+            worker(0, threads, barrier, finished);
+            for(auto &th: pool) th.join();
+        }
+        sys.flush();
+        for(auto &core: cores) core->report();
+        std::cout << std::dec << cores[0]->result() << std::endl;
     }
 
 };
@@ -0,0 +1,105 @@
+#include "../lib/predictor.h"
+#include "../lib/branch_trace.h"
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <unordered_map>
+
+// replays a branch trace written by `code --branch-trace=FILE` through several predictors
+
+namespace riscv {
+
+struct Replay_result {
+    Predictor_config cfg;
+    long long miss;
+    std::vector<std::pair<addr_t, long long> > worst;   // (pc, misses) of the worst branches
+};
+
+void replay(const std::vector<Branch_record> &trace, Replay_result &res, int top) {
+    auto bp = make_predictor(res.cfg);
+    std::unordered_map<addr_t, long long> miss;
+    res.miss = 0;
+    for(auto &rec: trace) {
+        if(bp->predict(rec.pc) != rec.jump) res.miss++, miss[rec.pc]++;
+        bp->update(rec.pc, rec.jump);
+    }
+    res.worst.assign(miss.begin(), miss.end());
+    std::sort(res.worst.begin(), res.worst.end(), [](const std::pair<addr_t, long long> &a, const std::pair<addr_t, long long> &b) {
+        return a.second > b.second || (a.second == b.second && a.first < b.first);
+    });
+    if(int(res.worst.size()) > top) res.worst.resize(top);
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    using namespace riscv;
+    std::string path;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int top = 0;
+    std::vector<Replay_result> res;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg.compare(0, 10, "--threads=") == 0) threads = std::max(1, std::atoi(arg.c_str() + 10));
+        else if(arg.compare(0, 6, "--top=") == 0) top = std::atoi(arg.c_str() + 6);
+        else if(path.empty()) path = arg;
+        else {
+            Replay_result item;
+            if(!Predictor_config::parse(arg, item.cfg)) {
+                std::cerr << "invalid predictor: " << arg << '\n';
+                return 1;
+            }
+            res.push_back(item);
+        }
+    }
+    if(path.empty()) {
+        std::cerr << "usage: bp_replay TRACE [--threads=N] [--top=N] [PREDICTOR...]\n";
+        std::cerr << "  PREDICTOR is NAME[:key=val,...] as accepted by code --bp\n";
+        return 1;
+    }
+    if(res.empty()) {
+        for(auto spec: {"bimodal", "gshare", "tournament", "tage", "perceptron"}) {
+            Replay_result item;
+            Predictor_config::parse(spec, item.cfg);
+            res.push_back(item);
+        }
+    }
+
+    Branch_trace_reader reader;
+    if(!reader.open(path)) {
+        std::cerr << "cannot read trace " << path << '\n';
+        return 1;
+    }
+    std::vector<Branch_record> trace;
+    Branch_record rec;
+    long long inst = 0;
+    while(reader.next(rec)) trace.push_back(rec), inst += rec.gap;
+    inst += reader.trailing();
+
+    std::atomic<int> next(0);
+    std::vector<std::thread> pool;
+    for(int t = 0; t < std::min(threads, int(res.size())); ++t) {
+        pool.emplace_back([&]() {
+            for(int i; (i = next++) < int(res.size()); ) replay(trace, res[i], top);
+        });
+    }
+    for(auto &th: pool) th.join();
+
+    std::cout << "instructions " << inst << ", branches " << trace.size() << '\n';
+    for(auto &item: res) {
+        std::cout << std::setw(48) << std::left << item.cfg.to_string() << std::right;
+        std::cout << " miss " << std::setw(10) << item.miss;
+        std::cout << " acc " << std::fixed << std::setprecision(4) << (trace.empty()? 1.0: 1.0 - 1.0 * item.miss / trace.size());
+        std::cout << " mpki " << std::fixed << std::setprecision(3) << (inst? 1000.0 * item.miss / inst: 0.0) << '\n';
+        for(auto &br: item.worst) {
+            std::cout << "    " << std::hex << std::setw(8) << std::setfill('0') << br.first << std::dec << std::setfill(' ');
+            std::cout << " miss " << br.second;
+            std::cout << " mpki " << std::fixed << std::setprecision(3) << (inst? 1000.0 * br.second / inst: 0.0) << '\n';
+        }
+    }
+    return 0;
+}
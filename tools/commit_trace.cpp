@@ -0,0 +1,79 @@
+#include "../lib/inst.h"
+#include "../lib/commit_trace.h"
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <unordered_map>
+
+// summarizes or prints a commit trace written by `code --commit-trace=FILE`
+
+int main(int argc, char *argv[]) {
+    using namespace riscv;
+    std::string path;
+    bool dump = 0;
+    int top = 10;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--dump") dump = 1;
+        else if(arg.compare(0, 6, "--top=") == 0) top = std::atoi(arg.c_str() + 6);
+        else if(path.empty()) path = arg;
+        else path.clear(), i = argc;
+    }
+    if(path.empty()) {
+        std::cerr << "usage: commit_trace TRACE [--dump] [--top=N]\n";
+        std::cerr << "  --dump prints every record, otherwise a summary with the N most executed pcs\n";
+        return 1;
+    }
+
+    Commit_trace_reader reader;
+    if(!reader.open(path)) {
+        std::cerr << "cannot read trace " << path << '\n';
+        return 1;
+    }
+    Decoder dec;
+    Commit_record rec;
+    long long insts[2] = {0, 0}, writes = 0, loads = 0, stores = 0;
+    std::unordered_map<addr_t, std::pair<inst_t, long long> > hot;
+    while(reader.next(rec)) {
+        insts[rec.thread]++;
+        writes += rec.rd != 0;
+        loads += rec.mem == 1, stores += rec.mem == 2;
+        if(!dump) {
+            auto &pc = hot[rec.pc];
+            pc.first = rec.org, pc.second++;
+            continue;
+        }
+        dec.decode(rec.org);
+        std::cout << std::hex << std::setfill('0');
+        std::cout << int(rec.thread) << ' ' << std::setw(8) << rec.pc << ' ' << std::setw(8) << rec.org << ' ';
+        std::cout << std::setfill(' ') << std::setw(10) << std::left << opt_to_string(dec.opt) << std::right << std::setfill('0');
+        if(rec.rd) std::cout << ' ' << (rec.rd < Decoder::FREG? 'x': 'f') << std::dec << rec.rd % Decoder::FREG << std::hex << '=' << std::setw(8) << rec.value;
+        if(rec.mem) {
+            std::cout << (rec.mem == 1? " load ": " store ") << std::dec << int(rec.size) << std::hex << " @" << std::setw(8) << rec.addr;
+            if(rec.mem == 2) std::cout << " =" << std::setw(8) << rec.data;
+        }
+        std::cout << std::dec << std::setfill(' ') << '\n';
+    }
+    if(dump) return 0;
+
+    long long total = insts[0] + insts[1];
+    std::cout << "instructions " << total;
+    if(insts[1]) std::cout << " (thread 0 " << insts[0] << ", thread 1 " << insts[1] << ")";
+    std::cout << ", register writes " << writes << ", loads " << loads << ", stores " << stores << '\n';
+    std::cout << "distinct pcs " << hot.size() << '\n';
+    std::vector<std::pair<addr_t, std::pair<inst_t, long long> > > pcs(hot.begin(), hot.end());
+    std::sort(pcs.begin(), pcs.end(), [](const std::pair<addr_t, std::pair<inst_t, long long> > &a, const std::pair<addr_t, std::pair<inst_t, long long> > &b) {
+        return a.second.second > b.second.second || (a.second.second == b.second.second && a.first < b.first);
+    });
+    if(int(pcs.size()) > top) pcs.resize(top);
+    for(auto &pc: pcs) {
+        dec.decode(pc.second.first);
+        std::cout << "    " << std::hex << std::setw(8) << std::setfill('0') << pc.first << std::dec << std::setfill(' ');
+        std::cout << ' ' << std::setw(10) << std::left << opt_to_string(dec.opt) << std::right;
+        std::cout << " count " << pc.second.second;
+        std::cout << " share " << std::fixed << std::setprecision(4) << 1.0 * pc.second.second / total << '\n';
+    }
+    return 0;
+}